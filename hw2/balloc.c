@@ -7,14 +7,20 @@
  */
 
 #include <math.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "balloc.h"
 #include "freelist.h"
+#include "cache.h"
+#include "large.h"
 #include "utils.h"
 
+// Freed blocks every order of a BALLOC_LAZY pool keeps unmerged (unless bsetslack() says otherwise)
+#define LAZY_SLACK 16
+
 // The representation of a Balloc
 struct Rep
 {
@@ -29,32 +35,102 @@ struct Rep
     FreeList freeList;
 
     // Size is saved as well
-    int size;
+    size_t size;
+
+    // How large the pool can get, the pool's part of the mapping is this
+    // long but only what has been committed can be used (equals size unless growable)
+    size_t limit;
+
+    // Size of the metadata (this struct, the freelist, its bitmaps and order table)
+    // that sits in front of the pool in the same mapping
+    size_t metaSize;
+
+    // Called (with its argument) when an allocation can not be satisfied
+    BallocHandler handler;
+    void *handlerArg;
+
+    // Whether threads cache free blocks, and the caches they have for this pool
+    int cached;
+    Caches caches;
+
+    // A pool made by bcreatearenas() hands everything to its arenas (0 for any other pool)
+    // The arenas are sorted by address, so a block's arena can be searched for
+    int arenaCount;
+    struct Rep **arenas;
+
+    // Whether an arena is picked by the CPU a call runs on (otherwise by thread)
+    int perCpu;
+
+    // Blocks of an arena that other threads freed, linked through their first words
+    // Anyone pushes with compare and swap, and they are taken all at once and
+    // freed for real by the next allocation from the arena (before it can grow)
+    void *remoteFrees;
+
+    // Blocks too big for the pool, each mapped on its own
+    Larges larges;
 
 } typedef Rep;
 
+// Arena of the calling thread (-1 until it first allocates from a pool with arenas)
+static __thread int threadArena __attribute__((tls_model("initial-exec"))) = -1;
+
+// Threads are handed arenas round-robin
+static unsigned int nextArena;
+
 // Creates a pool of memory that can be chunked off into
 // blocks that are powers of 2 (Ex: 2^n, [0: 1, 1: 2, 2: 4, etc.]) and can
 // then have parts of the memory segmented
+// The pool itself does not need to be a power of 2, whatever is left past the
+// last 2^u block is split into smaller blocks (down to 2^l)
+// The pool starts on a 2^u boundary, so every block is aligned to its own size
 // size = Given number of bytes to create the pool
 // l = Determines the lowest possible allocation
 // u = Determines the highest possible allocation
-// Returns: Balloc, a void pointer to the struct
-Balloc bcreate(unsigned int size, int l, int u)
+// Returns: Balloc, a void pointer to the struct, or NULL if the size or bounds are not valid
+Balloc bcreate(size_t size, int l, int u)
+{
+    return bcreatex(size, l, u, 0, 0);
+}
+
+// Creates a pool like bcreate() but with flags
+// With BALLOC_GROWABLE the address space for limit bytes is reserved up front
+// and only size bytes are committed, the pool grows in place (by 2^u blocks)
+// when an allocation does not fit, so nothing that was handed out ever moves
+// With BALLOC_THREADSAFE balloc(), bfree() and bsize() can be called from many
+// threads at once, each order level is locked on its own so requests of
+// different sizes do not wait on each other
+// With BALLOC_CACHED every thread also keeps a cache of free blocks per order,
+// so allocating and freeing the same sizes over and over does not take a lock
+// (a cached block only goes back to the pool when its thread's cache is full,
+// the thread exits, or the thread runs out of memory)
+// With BALLOC_LOCKFREE every order level is a lock-free stack instead, freed
+// blocks are only merged when the pool runs dry (it can be used with BALLOC_CACHED)
+// With BALLOC_LAZY freed blocks are not merged right away, every order keeps
+// up to LAZY_SLACK of them (see bsetslack()) for the next allocations of its size
+// With BALLOC_ORDERED every order hands out its lowest free block, and a free
+// block is split before the wilderness is touched, so the pool stays packed at its start
+// size = Given number of bytes to create the pool with
+// l = Determines the lowest possible allocation
+// u = Determines the highest possible allocation
+// limit = Most bytes the pool can grow to (ignored unless growable)
+// flags = BALLOC_GROWABLE, BALLOC_THREADSAFE, BALLOC_CACHED, BALLOC_LOCKFREE, BALLOC_LAZY and/or BALLOC_ORDERED, or 0
+// Returns: Balloc, a void pointer to the struct, or NULL if the size, bounds or limit are not valid
+Balloc bcreatex(size_t size, int l, int u, size_t limit, int flags)
 {
 
     // Used for keeping track of the size for the memory pool
-    const unsigned int requestedSize = size;
-    unsigned int actualSize;
+    const size_t requestedSize = size;
+    size_t actualSize;
 
     // Highest block size that memory can be allocated from the pool
-    int highestAllocationSize;
+    size_t highestAllocationSize;
 
     // Keeping track of 'r', how many buddies will exist in the allocator
     int numberOfBuddies;
 
     // Used for aliasing
-    const int lower = l, upper = u;
+    int lower = l;
+    const int upper = u;
 
     // Checking for valid size call
     if (requestedSize <= 0)
@@ -63,7 +139,7 @@ Balloc bcreate(unsigned int size, int l, int u)
 
         // Output error message
         fprintf(stderr, "Invalid size call. Requires a nonzero positive number!\n");
-        exit(1);
+        return NULL;
     }
 
     // Checking size of l (lowest) and u (highest) are valid
@@ -73,7 +149,7 @@ Balloc bcreate(unsigned int size, int l, int u)
 
         // Output error message
         fprintf(stderr, "Invalid size constraints provided. l and u should be nonzero positive numbers!\n");
-        exit(1);
+        return NULL;
     }
     else if (lower > upper)
     {
@@ -81,28 +157,139 @@ Balloc bcreate(unsigned int size, int l, int u)
 
         // Output error message
         fprintf(stderr, "Upper bound is less than lower bounds. That makes no sense...\n");
-        exit(1);
+        return NULL;
+    }
+    else if (upper > freelistmaxexponent())
+    {
+        // Upper bound is past the largest level a freelist keeps
+
+        // Output error message
+        fprintf(stderr, "Upper bound is too big, blocks can be at most 2^%d bytes!\n", freelistmaxexponent());
+        return NULL;
+    }
+
+    // Free blocks hold their own list node, so the smallest block must be able to fit one
+    if (lower < freelistminexponent())
+    {
+        // Normalizing lower to the smallest block that can hold a node
+        lower = freelistminexponent();
+
+        // Checking the bounds still make sense
+        if (lower > upper)
+        {
+            // Output error message
+            fprintf(stderr, "Upper bound is too small, blocks must be at least 2^%d bytes!\n", lower);
+            return NULL;
+        }
     }
 
     // Highest block size that can be created in this pool
     // by calling the utils e2size() method
     highestAllocationSize = e2size(upper);
-    actualSize = e2size(size2e(size));
+
+    // Only rounding to the smallest block, so the mapping is what was asked for
+    actualSize = roundup(size, e2size(lower));
+
+    // How the freelist is shared between threads
+    // (caching is only safe when it is shared)
+    int mode = FREELIST_PLAIN;
+    if (flags & BALLOC_LOCKFREE)
+    {
+        mode = FREELIST_LOCKFREE;
+    }
+    else if (flags & (BALLOC_THREADSAFE | BALLOC_CACHED))
+    {
+        mode = FREELIST_LOCKED;
+    }
+
+    // Lock-free levels are stacks, so only the others can be kept in address order
+    const int ordered = (flags & BALLOC_ORDERED) && mode != FREELIST_LOCKFREE;
+
+    // A pool that can not grow is limited to its own size
+    size_t limitSize = actualSize;
+
+    if (flags & BALLOC_GROWABLE)
+    {
+
+        // The limit is rounded like the size
+        limitSize = roundup(limit, e2size(lower));
+
+        // Checking the limit is not below the starting size
+        if (limitSize < actualSize)
+        {
+
+            // Output error message
+            fprintf(stderr, "Invalid limit. A growable pool can not be limited below its size!\n");
+            return NULL;
+        }
+    }
 
     // Checking if size will conflict with the lowest or highest bounds
-    if (actualSize < highestAllocationSize)
+    // (a growable pool only has to be able to reach 2^u)
+    if (limitSize < highestAllocationSize)
     {
 
         // Output error message
-        fprintf(stderr, "Will not be able to allocate blocks at the highest level provided. AKA, %d is too small for 2^%d (%d)", size, u, highestAllocationSize);
-        exit(1);
+        fprintf(stderr, "Will not be able to allocate blocks at the highest level provided. AKA, %zu is too small for 2^%d (%zu)\n", size, u, highestAllocationSize);
+        return NULL;
+    }
+
+    // Checking the freelist can keep track of a pool this big
+    if (limitSize > freelistmaxsize(lower, mode))
+    {
+
+        // Output error message
+        fprintf(stderr, "Pool is too big, at most %zu bytes with these bounds and flags!\n", freelistmaxsize(lower, mode));
+        return NULL;
+    }
+
+    // Everything the pool needs goes in one mapping, laid out as
+    // [Rep][freelist, bitmaps, order table][pool]
+    // with the metadata rounded up to a page so the pool starts page aligned
+    // (the metadata covers the limit, so growing never has to move it)
+    const size_t repSize = roundup(sizeof(Rep), cachelinesize);
+    const size_t metaSize = roundup(repSize + freelistspace(limitSize, lower, upper, ordered), pagesize());
+
+    // Mapping the metadata and the memory in the address space to be used
+    // Reserving the whole range but only committing what is used now, with
+    // room to line the pool up on a 2^u boundary (so every block is aligned
+    // to its own size), and giving back what is left over on either side
+    // (a pool that can not grow has its limit at its size, so all of it is committed)
+    const size_t reservedSize = metaSize + limitSize + highestAllocationSize;
+    char *reserved = mmreserve(reservedSize);
+    if (reserved == NULL)
+    {
+
+        // Output error message
+        fprintf(stderr, "Could not reserve the address space for the pool!\n");
+        return NULL;
+    }
+    char *region = (char *)roundup((size_t)reserved + metaSize, highestAllocationSize) - metaSize;
+
+    char *tail = region + roundup(metaSize + limitSize, pagesize());
+    if (region > reserved)
+    {
+        mmfree(reserved, region - reserved);
+    }
+    if (reserved + reservedSize > tail)
+    {
+        mmfree(tail, reserved + reservedSize - tail);
     }
 
-    // Creating Balloc struct to have the pool initialized
-    Rep *newBalloc = mmalloc(sizeof(Rep));
+    if (!mmcommit(region, metaSize + actualSize))
+    {
 
-    // Mapping the memory in the address space to be used
-    void *poolAddr = mmalloc(actualSize);
+        // Output error message
+        fprintf(stderr, "Could not commit the memory for the pool!\n");
+        mmfree(region, metaSize + limitSize);
+        return NULL;
+    }
+
+    // Creating Balloc struct at the start of the mapping
+    Rep *newBalloc = (Rep *)region;
+
+    // The pool comes after the metadata
+    void *poolAddr = region + metaSize;
 
     // Save address into newBalloc for start of pool
     newBalloc->pool = poolAddr;
@@ -119,16 +306,247 @@ Balloc bcreate(unsigned int size, int l, int u)
     newBalloc->managementData[1] = upper;
     newBalloc->managementData[2] = numberOfBuddies;
 
-    // Storing size
+    // Storing sizes
     newBalloc->size = actualSize;
+    newBalloc->limit = limitSize;
+    newBalloc->metaSize = metaSize;
+    newBalloc->cached = (flags & BALLOC_CACHED) != 0;
+
+    // Adding the freelist to the newBalloc, built in the metadata right after it
+    newBalloc->freeList = freelistcreate(actualSize, limitSize, lower, upper, poolAddr, region + repSize, mode, ordered);
 
-    // Adding the freelist to the newBalloc
-    newBalloc->freeList = freelistcreate(actualSize, lower, upper, poolAddr);
+    // Every order that can merge gets its slack
+    if (flags & BALLOC_LAZY)
+    {
+        for (int i = lower; i < upper; i++)
+        {
+            freelistslack(newBalloc->freeList, i, LAZY_SLACK);
+        }
+    }
 
     // Returning the address of the created Balloc
     return (void *)newBalloc;
 }
 
+// Picks the arena the calling thread should try first
+// * front = A pool made by bcreatearenas()
+// Returns: int, the index of the arena
+static int pickarena(Rep *front)
+{
+    // The CPU the call is on, if that is how arenas are picked (and the system can say)
+    if (front->perCpu)
+    {
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+        {
+            return cpu % front->arenaCount;
+        }
+    }
+
+    // Otherwise each thread sticks to the arena it was handed
+    if (threadArena < 0)
+    {
+        threadArena = __atomic_fetch_add(&nextArena, 1, __ATOMIC_RELAXED) & 0x7fffffff;
+    }
+
+    return threadArena % front->arenaCount;
+}
+
+// Finds the arena whose range an address is in
+// * front = A pool made by bcreatearenas()
+// * mem = The address
+// Returns: Rep *, the arena, or NULL if the address is in none of them
+static Rep *findarena(Rep *front, void *mem)
+{
+    // Last arena that starts at or before the block
+    int low = 0, high = front->arenaCount - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if ((char *)front->arenas[middle]->pool <= (char *)mem)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    // Checking the address is inside it
+    Rep *arena = front->arenas[low];
+    if ((char *)mem < (char *)arena->pool || (char *)mem >= (char *)arena->pool + arena->limit)
+    {
+        return NULL;
+    }
+
+    return arena;
+}
+
+// Finds the arena a block was allocated from by its address
+// * front = A pool made by bcreatearenas()
+// * mem = The block
+// Returns: Rep *, the arena (exits if the block is in none of them)
+static Rep *ownerarena(Rep *front, void *mem)
+{
+    Rep *arena = findarena(front, mem);
+    if (arena == NULL)
+    {
+        // Outputting error messsage
+        fprintf(stderr, "Memory is not a block in this pool!\n");
+        exit(1);
+    }
+
+    return arena;
+}
+
+// Queues a block freed by a thread that is not using its arena
+// The block is marked queued first, so freeing it again before the queue is
+// drained fails like freeing any block twice (instead of linking it in twice)
+// * arena = The arena the block belongs to
+// * mem = The block (already checked to be allocated)
+static void remotefree(Rep *arena, void *mem)
+{
+    freelistqueue(arena->freeList, arena->pool, mem, arena->managementData[0]);
+
+    void *head = __atomic_load_n(&arena->remoteFrees, __ATOMIC_RELAXED);
+    do
+    {
+        *(void **)mem = head;
+    } while (!__atomic_compare_exchange_n(&arena->remoteFrees, &head, mem, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Queues many blocks freed by a thread that is not using their arena, in one go
+// * arena = The arena the blocks belong to
+// ** blocks = The blocks (already checked to be allocated)
+// n = How many blocks there are (at least 1)
+static void remotefreen(Rep *arena, void **blocks, size_t n)
+{
+    // Marking them queued (like remotefree()) and linking them to each other first, so the queue only changes once
+    for (size_t i = 0; i < n; i++)
+    {
+        freelistqueue(arena->freeList, arena->pool, blocks[i], arena->managementData[0]);
+    }
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        *(void **)blocks[i] = blocks[i + 1];
+    }
+
+    void *head = __atomic_load_n(&arena->remoteFrees, __ATOMIC_RELAXED);
+    do
+    {
+        *(void **)blocks[n - 1] = head;
+    } while (!__atomic_compare_exchange_n(&arena->remoteFrees, &head, blocks[0], 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Frees every block other threads queued on an arena, merging them like any free
+// * arena = The arena
+// Returns: int, how many blocks were freed
+static int drainremote(Rep *arena)
+{
+    // Nothing queued (checked first so the line is not taken for nothing)
+    if (__atomic_load_n(&arena->remoteFrees, __ATOMIC_RELAXED) == NULL)
+    {
+        return 0;
+    }
+
+    // Taking the whole queue, nobody else can see these blocks now
+    void *blocks = __atomic_exchange_n(&arena->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+
+    int count = 0;
+    while (blocks)
+    {
+        void *block = blocks;
+        blocks = *(void **)block;
+        freelistunqueue(arena->freeList, arena->pool, block, arena->managementData[0]);
+        bfree(arena, block);
+        count++;
+    }
+
+    return count;
+}
+
+// Creates a pool made of n independent arenas, each one a pool like bcreatex() makes
+// Every thread allocates from its own arena (handed out round-robin, or by the
+// CPU it is on with BALLOC_PERCPU) and moves on to the next ones when its arena
+// is out of memory, a block is freed back to the arena its address is in
+// A block freed by a thread that uses another arena is queued on its arena and
+// only freed for real (in one go) the next time something is allocated from that arena
+// The arenas are always thread safe (BALLOC_THREADSAFE is added unless lock-free)
+// size = Given number of bytes for each arena
+// l = Determines the lowest possible allocation
+// u = Determines the highest possible allocation
+// limit = Most bytes each arena can grow to (ignored unless growable)
+// flags = bcreatex() flags, plus BALLOC_PERCPU
+// n = How many arenas
+// Returns: Balloc, a void pointer to the struct, or NULL if an arena could not be created
+Balloc bcreatearenas(size_t size, int l, int u, size_t limit, int flags, int n)
+{
+
+    // Checking for a valid number of arenas
+    if (n <= 0)
+    {
+
+        // Output error message
+        fprintf(stderr, "Invalid number of arenas. Requires a nonzero positive number!\n");
+        return NULL;
+    }
+
+    // The front end and its table of arenas go in one mapping
+    const size_t repSize = roundup(sizeof(Rep), cachelinesize);
+    const size_t mappedSize = repSize + n * sizeof(Rep *);
+    Rep *front = mmalloc(mappedSize);
+    if (front == NULL)
+    {
+        return NULL;
+    }
+    front->arenas = (Rep **)((char *)front + repSize);
+    front->metaSize = mappedSize;
+
+    // Threads fall over into each other's arenas, so they have to be shared
+    if (!(flags & BALLOC_LOCKFREE))
+    {
+        flags |= BALLOC_THREADSAFE;
+    }
+
+    // Creating the arenas, kept sorted by address as they come
+    for (int i = 0; i < n; i++)
+    {
+        Rep *arena = bcreatex(size, l, u, limit, flags);
+
+        // Giving up on all of them if one can not be made
+        if (arena == NULL)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                bdelete(front->arenas[j]);
+            }
+            mmfree(front, mappedSize);
+            return NULL;
+        }
+
+        int j = i;
+        while (j > 0 && (char *)front->arenas[j - 1]->pool > (char *)arena->pool)
+        {
+            front->arenas[j] = front->arenas[j - 1];
+            j--;
+        }
+        front->arenas[j] = arena;
+    }
+
+    // Storing management data and sizes like any pool, the sizes are over all arenas
+    front->managementData[0] = front->arenas[0]->managementData[0];
+    front->managementData[1] = front->arenas[0]->managementData[1];
+    front->managementData[2] = front->arenas[0]->managementData[2];
+    front->size = n * front->arenas[0]->size;
+    front->limit = n * front->arenas[0]->limit;
+    front->arenaCount = n;
+    front->perCpu = (flags & BALLOC_PERCPU) != 0;
+
+    // Returning the address of the created Balloc
+    return (void *)front;
+}
+
 // Deletes the pool of memory that was created
 // pool = A Balloc struct that contains the memory map
 void bdelete(Balloc pool)
@@ -147,24 +565,26 @@ void bdelete(Balloc pool)
         exit(1);
     }
 
-    // 3 Things need to be deleted and NULLed
-    // 1. Pool Address
-    // 2. Freelist
-    // 3. Management Data
+    // Blocks that were mapped on their own go first
+    largedelete(&ballocPool->larges);
 
-    // 1. Pool Address
-    if (ballocPool->pool != NULL)
+    // A pool with arenas deletes every arena, then its own mapping
+    if (ballocPool->arenaCount)
     {
-        // Base address is still valid
-
-        // Unmap the memory pool
-        mmfree(ballocPool->pool, ballocPool->size);
-
-        // Make sure to set the address to NULL
-        ballocPool->pool = NULL;
+        for (int i = 0; i < ballocPool->arenaCount; i++)
+        {
+            bdelete(ballocPool->arenas[i]);
+        }
+        mmfree(ballocPool, ballocPool->metaSize);
+        return;
     }
 
-    // 2. Freelist
+    // 3 Things need to be deleted and NULLed
+    // 1. Freelist
+    // 2. Management Data
+    // 3. The mapping (Allocator, metadata and pool together)
+
+    // 1. Freelist
     // Grabbing freelist
     const FreeList list = ballocPool->freeList;
 
@@ -175,18 +595,26 @@ void bdelete(Balloc pool)
     // * Not needed
     // const int size = ballocPool->size;
 
-    // Unmapping the freelist
+    // Threads can not give blocks back to it anymore
+    cachedetach(&ballocPool->caches);
+
+    // Emptying the freelist
     freelistdelete(list, lower, upper);
 
-    // 3. Management Data
+    // 2. Management Data
+    // Grabbing the size of the mapping before it is cleared
+    const size_t mappedSize = ballocPool->metaSize + ballocPool->limit;
+
     // Setting all values to 0
     ballocPool->managementData[0] = 0;
     ballocPool->managementData[1] = 0;
     ballocPool->managementData[2] = 0;
     ballocPool->size = 0;
+    ballocPool->limit = 0;
+    ballocPool->pool = NULL;
 
-    // Unmapping the Allocator
-    mmfree(ballocPool, sizeof(Rep));
+    // 3. Unmapping the Allocator along with its metadata and pool
+    mmfree(ballocPool, mappedSize);
 
     // Allocator has been deleted!
     return;
@@ -195,22 +623,22 @@ void bdelete(Balloc pool)
 // Allocates memory from a pool using the Buddy System Algorithm
 // pool = A Balloc struct that contains the memory map
 // size = A number of bytes that is requested to be allocated in the pool
-// Returns: void *, the address where the allocation was initiated
-void *balloc(Balloc pool, unsigned int size)
+// A request bigger than 2^u is mapped on its own instead (bfree(), bsize() and
+// brealloc() still take it), aligned to 2^u or a page, whichever is bigger
+// Returns: void *, the address where the allocation was initiated, or NULL if
+// the pool has no room for it (after the out of memory handler gives up)
+void *balloc(Balloc pool, size_t size)
 {
 
     // Used for keeping track of the size
-    const int requestedSize = size;
+    const size_t requestedSize = size;
     int actualSizeE;
 
     // Check parameters
     if (size < 1)
     {
-        // Size requested is nothing
-
-        // Outputting error message
-        fprintf(stderr, "Size requested is not valid (must be positive integer)\n");
-        exit(1);
+        // Size requested is nothing, so nothing is allocated
+        return NULL;
     }
     else
     {
@@ -229,7 +657,44 @@ void *balloc(Balloc pool, unsigned int size)
     }
 
     // Grabbing representation of pool
-    const Rep *ballocPool = (Rep *)pool;
+    Rep *ballocPool = (Rep *)pool;
+
+    // No block is big enough, so it is mapped on its own (aligned like the biggest blocks)
+    if (requestedSize > e2size(ballocPool->managementData[1]))
+    {
+        void *allocatedSpot;
+        do
+        {
+            allocatedSpot = largealloc(&ballocPool->larges, requestedSize, e2size(ballocPool->managementData[1]));
+        } while (allocatedSpot == NULL && ballocPool->handler && ballocPool->handler(pool, size, ballocPool->handlerArg));
+
+        return allocatedSpot;
+    }
+
+    // A pool with arenas tries the caller's arena first, then the others in turn
+    if (ballocPool->arenaCount)
+    {
+        int first = pickarena(ballocPool);
+        void *allocatedSpot;
+
+        do
+        {
+            allocatedSpot = NULL;
+            for (int i = 0; allocatedSpot == NULL && i < ballocPool->arenaCount; i++)
+            {
+                Rep *arena = ballocPool->arenas[(first + i) % ballocPool->arenaCount];
+
+                // Blocks other threads freed into it are reused before it grows
+                // (an arena only runs out of memory once it has grown to its limit)
+                drainremote(arena);
+                allocatedSpot = balloc(arena, size);
+            }
+
+            // Every arena is out of memory, let the handler make room if there is one
+        } while (allocatedSpot == NULL && ballocPool->handler && ballocPool->handler(pool, size, ballocPool->handlerArg));
+
+        return allocatedSpot;
+    }
 
     // Accessing the freelist to allocate
     const FreeList list = ballocPool->freeList;
@@ -243,28 +708,160 @@ void *balloc(Balloc pool, unsigned int size)
     // Grabbing upper constrant (verification of allocation requested)
     const int upper = ballocPool->managementData[1];
 
-    // Checking if allocation is a valid size in what is requested
-    if (requestedSize > e2size(upper))
+    // Checking if the allocation exponent needs to be set on lower constraint if value is too small
+    if (actualSizeE < lower)
     {
-        // Allocation is not within valid constraints
+        // Normalizing exponent to lower
+        actualSizeE = lower;
+    }
 
-        // Outputting error message
-        fprintf(stderr, "Cannot allocate this amount as it is above the allocators constraints (%d)!\n", requestedSize);
+    // Calling the freelist to allocate the memory (through the thread's cache if the pool has them)
+    void *allocatedSpot = ballocPool->cached ? cachealloc(&ballocPool->caches, list, poolAddr, actualSizeE, lower, upper) : freelistalloc(list, poolAddr, actualSizeE, lower);
+
+    // Out of memory, but this thread may be sitting on free blocks that could be merged
+    if (allocatedSpot == NULL && ballocPool->cached)
+    {
+        cacheflush(&ballocPool->caches);
+        allocatedSpot = freelistalloc(list, poolAddr, actualSizeE, lower);
+    }
+
+    // Out of memory, let the handler make room and try again for as long as it asks to
+    while (allocatedSpot == NULL && ballocPool->handler && ballocPool->handler(pool, size, ballocPool->handlerArg))
+    {
+        allocatedSpot = freelistalloc(list, poolAddr, actualSizeE, lower);
+    }
+
+    // Return the address at the start of the allocation (NULL if there was no room)
+    return allocatedSpot;
+}
+
+// Allocates memory from a pool aligned to a power of two
+// A block is aligned to its own size, so a block of at least align bytes is
+// used when the pool has one that big, otherwise it is mapped on its own
+// pool = A Balloc struct that contains the memory map
+// size = A number of bytes that is requested to be allocated in the pool
+// align = The alignment, a power of two
+// Returns: void *, the address of the allocation, or NULL if align is not a
+// power of two or there is no room for it (after the out of memory handler gives up)
+void *ballocalign(Balloc pool, size_t size, size_t align)
+{
+    // Verify pool
+    if (!pool)
+    {
+        // Ouputting error message
+        fprintf(stderr, "Pool does not exist!");
         exit(1);
     }
 
-    // Checking if the allocation exponent needs to be set on lower constraint if value is too small
+    // Nothing is requested, or it can not be aligned
+    if (size < 1 || align == 0 || (align & (align - 1)))
+    {
+        return NULL;
+    }
+
+    // Grabbing representation of pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // The pool has blocks that are aligned well enough (a request too big for them is mapped aligned to 2^u)
+    if (align <= e2size(ballocPool->managementData[1]))
+    {
+        return balloc(pool, size > align ? size : align);
+    }
+
+    // Otherwise it is mapped on its own at the alignment
+    void *allocatedSpot;
+    do
+    {
+        allocatedSpot = largealloc(&ballocPool->larges, size, align);
+    } while (allocatedSpot == NULL && ballocPool->handler && ballocPool->handler(pool, size, ballocPool->handlerArg));
+
+    return allocatedSpot;
+}
+
+// Allocates many blocks of the same size at once
+// A big block is split once and handed out as adjacent blocks (in address order),
+// instead of going through the freelist for every block. Blocks too big for the
+// pool are mapped one by one. Thread caches are not used for the blocks
+// pool = A Balloc struct that contains the memory map
+// size = A number of bytes that is requested for every block
+// n = How many blocks are requested
+// ** blocks = Where the blocks are stored (room for n)
+// Returns: size_t, how many blocks were allocated, fewer than n if the pool
+// ran out of room (after the out of memory handler gives up)
+size_t ballocn(Balloc pool, size_t size, size_t n, void **blocks)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Ouputting error message
+        fprintf(stderr, "Pool does not exist!");
+        exit(1);
+    }
+
+    // Nothing is allocated for nothing
+    if (size < 1)
+    {
+        return 0;
+    }
+
+    // Grabbing representation of pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // Grabbing lower and upper constraints
+    const int lower = ballocPool->managementData[0];
+    const int upper = ballocPool->managementData[1];
+
+    // Normalizing the size exponent
+    int actualSizeE = size2e(size);
     if (actualSizeE < lower)
     {
-        // Normalizing exponent to lower
         actualSizeE = lower;
     }
 
-    // Calling the freelist to allocate the memory
-    void *allocatedSpot = freelistalloc(list, poolAddr, actualSizeE, lower);
+    size_t count = 0;
 
-    // Return the address at the start of the allocation
-    return allocatedSpot;
+    do
+    {
+        if (actualSizeE > upper)
+        {
+            // Too big for any block, every one is mapped on its own
+            while (count < n && (blocks[count] = largealloc(&ballocPool->larges, size, e2size(upper))))
+            {
+                count++;
+            }
+        }
+        else if (ballocPool->arenaCount)
+        {
+            // A pool with arenas takes what it can from the caller's arena first, then the others in turn
+            int first = pickarena(ballocPool);
+            for (int i = 0; count < n && i < ballocPool->arenaCount; i++)
+            {
+                Rep *arena = ballocPool->arenas[(first + i) % ballocPool->arenaCount];
+
+                // Blocks other threads freed into it are reused before it grows
+                drainremote(arena);
+                count += ballocn(arena, size, n - count, blocks + count);
+            }
+        }
+        else
+        {
+            count += freelistallocn(ballocPool->freeList, ballocPool->pool, actualSizeE, lower, n - count, blocks + count);
+
+            // This thread may be sitting on free blocks that could be merged
+            if (count < n && ballocPool->cached)
+            {
+                cacheflush(&ballocPool->caches);
+                count += freelistallocn(ballocPool->freeList, ballocPool->pool, actualSizeE, lower, n - count, blocks + count);
+            }
+        }
+
+        // Out of memory, let the handler make room and try again for as long as it asks to
+    } while (count < n && ballocPool->handler && ballocPool->handler(pool, size, ballocPool->handlerArg));
+
+    return count;
 }
 
 // Frees the block of memory that is allocated
@@ -294,7 +891,38 @@ void bfree(Balloc pool, void *mem)
     }
 
     // Grab the representation of the pool
-    const Rep *ballocPool = (Rep *)pool;
+    Rep *ballocPool = (Rep *)pool;
+
+    // A block outside the pool can only be one that was mapped on its own
+    if (!bowns(pool, mem))
+    {
+        if (!largefree(&ballocPool->larges, mem))
+        {
+            // Outputting error message
+            fprintf(stderr, "Memory is not a block in this pool!\n");
+            exit(1);
+        }
+
+        return;
+    }
+
+    // A pool with arenas frees it in the arena it came from, or queues it there
+    // if the calling thread uses another arena (so it does not take that arena's locks)
+    if (ballocPool->arenaCount)
+    {
+        Rep *arena = ownerarena(ballocPool, mem);
+
+        if (arena != ballocPool->arenas[pickarena(ballocPool)])
+        {
+            // Checking it is allocated now, not when the queue is drained
+            bsize(arena, mem);
+            remotefree(arena, mem);
+            return;
+        }
+
+        bfree(arena, mem);
+        return;
+    }
 
     // Accessing the freelist to allocate
     const FreeList list = ballocPool->freeList;
@@ -305,24 +933,128 @@ void bfree(Balloc pool, void *mem)
     // Grabbing lower constraint
     const int lower = ballocPool->managementData[0];
 
-    // Getting size of the block
-    unsigned int sizeOfBlock = bsize(pool, mem);
+    // Grabbing upper constraint
+    const int upper = ballocPool->managementData[1];
+
+    // Getting size of the block (in exponent form), this also verifies it is allocated
+    int exponentOfBlock = freelistsize(list, poolAddr, mem, lower, upper);
 
-    // Freeing the block
-    // * MAKE SURE TO VERIFY IT IS ALLOCATED ALREADY
-    // ^ Might not need to check that
-    // * What if cannot free?
-    freelistfree(list, poolAddr, mem, size2e(sizeOfBlock), lower);
+    // Freeing the block (into the thread's cache if the pool has them)
+    if (ballocPool->cached)
+    {
+        cachefree(&ballocPool->caches, list, poolAddr, mem, exponentOfBlock, lower, upper);
+    }
+    else
+    {
+        freelistfree(list, poolAddr, mem, exponentOfBlock, lower);
+    }
 
     // Block is freed!
     return;
 }
 
+// Frees blocks of one pool (not one with arenas) that are sorted by address
+// and already checked to be allocated
+// * ballocPool = The pool
+// ** blocks = The blocks, all in the pool
+// n = How many blocks there are
+static void freesorted(Rep *ballocPool, void **blocks, size_t n)
+{
+    freelistfreen(ballocPool->freeList, ballocPool->pool, blocks, n, ballocPool->managementData[0]);
+}
+
+// Frees many allocated blocks at once
+// The blocks are sorted by address (once) and buddies that are both in the batch are
+// merged with each other first, so only the merged blocks touch the freelist
+// (thread caches are not used for them)
+// Every block is checked before any is freed, so a bad batch changes nothing
+// pool = A Balloc struct that contains the memory map
+// ** blocks = The blocks to free (the array is reordered)
+// n = How many blocks there are
+void bfreen(Balloc pool, void **blocks, size_t n)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Outputting error message
+        fprintf(stderr, "Pool does not exist!\n");
+        exit(1);
+    }
+
+    // Grab the representation of the pool
+    Rep *ballocPool = (Rep *)pool;
+
+    qsort(blocks, n, sizeof(void *), compareaddresses);
+
+    // Checking every block (bsize() gives up on one that is not allocated), and that none is there twice
+    for (size_t i = 0; i < n; i++)
+    {
+        bsize(pool, blocks[i]);
+
+        if (i > 0 && blocks[i] == blocks[i - 1])
+        {
+            // Outputting error message
+            fprintf(stderr, "Memory is not an allocated block!\n");
+            exit(1);
+        }
+    }
+
+    // Blocks outside the pool are freed one by one, the rest stay sorted at the front of the array
+    size_t inPool = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bowns(pool, blocks[i]))
+        {
+            blocks[inPool++] = blocks[i];
+        }
+        else
+        {
+            largefree(&ballocPool->larges, blocks[i]);
+        }
+    }
+
+    // A pool with arenas hands each arena its own blocks, which are next to each other once sorted
+    // (queueing them on arenas the calling thread does not use, like bfree())
+    if (ballocPool->arenaCount)
+    {
+        Rep *own = ballocPool->arenas[pickarena(ballocPool)];
+
+        size_t start = 0;
+        while (start < inPool)
+        {
+            Rep *arena = ownerarena(ballocPool, blocks[start]);
+
+            size_t end = start + 1;
+            while (end < inPool && (char *)blocks[end] < (char *)arena->pool + arena->limit)
+            {
+                end++;
+            }
+
+            if (arena == own)
+            {
+                freesorted(arena, blocks + start, end - start);
+            }
+            else
+            {
+                remotefreen(arena, blocks + start, end - start);
+            }
+            start = end;
+        }
+
+        return;
+    }
+
+    freesorted(ballocPool, blocks, inPool);
+}
+
 // Grabs the size of the memory block
 // pool = A Balloc struct that contains the memory map
 // * mem = A void pointer that is pointing at the block of memory to grab its size
-// Returns: int, the size of the block
-unsigned int bsize(Balloc pool, void *mem)
+// Returns: size_t, the size of the block
+size_t bsize(Balloc pool, void *mem)
 {
 
     // Verify pool
@@ -346,7 +1078,27 @@ unsigned int bsize(Balloc pool, void *mem)
     }
 
     // Grab the representation of the pool
-    const Rep *ballocPool = (Rep *)pool;
+    Rep *ballocPool = (Rep *)pool;
+
+    // A block outside the pool can only be one that was mapped on its own
+    if (!bowns(pool, mem))
+    {
+        size_t largeSize = largesize(&ballocPool->larges, mem);
+        if (largeSize == 0)
+        {
+            // Outputting error message
+            fprintf(stderr, "Memory is not a block in this pool!\n");
+            exit(1);
+        }
+
+        return largeSize;
+    }
+
+    // A pool with arenas asks the arena it came from
+    if (ballocPool->arenaCount)
+    {
+        return bsize(ownerarena(ballocPool, mem), mem);
+    }
 
     // Accessing the freelist to allocate
     const FreeList list = ballocPool->freeList;
@@ -368,6 +1120,138 @@ unsigned int bsize(Balloc pool, void *mem)
     return e2size(blockSize);
 }
 
+// Resizes a block of a pool (or arena) where it is
+// * ballocPool = The pool the block belongs to
+// * mem = The block (already checked to be allocated)
+// size = The number of bytes the block should hold (at most 2^u)
+// Returns: int, 1 if the block now has the size's order, 0 if it can not grow where it is
+static int resizeblock(Rep *ballocPool, void *mem, size_t size)
+{
+    // Grabbing lower and upper constraints
+    const int lower = ballocPool->managementData[0];
+    const int upper = ballocPool->managementData[1];
+
+    // Exponent the block has, and the one it should have
+    const int exponentOfBlock = freelistsize(ballocPool->freeList, ballocPool->pool, mem, lower, upper);
+    int newExponent = size2e(size);
+    if (newExponent < lower)
+    {
+        newExponent = lower;
+    }
+
+    // Already the right size
+    if (newExponent == exponentOfBlock)
+    {
+        return 1;
+    }
+
+    return freelistresize(ballocPool->freeList, ballocPool->pool, mem, exponentOfBlock, newExponent, lower);
+}
+
+// Resizes an allocated block, keeping what it holds (up to the smaller of the two sizes)
+// A block of the pool is resized where it is when it can be: it keeps its
+// order, gives the right halves back when it shrinks, or takes its free right
+// hand buddies when it grows. A block too big for the pool that stays too big
+// is remapped. Either way its bytes are never copied
+// pool = A Balloc struct that contains the memory map
+// * mem = The block to resize (NULL to allocate a new one)
+// size = The number of bytes the block should hold (0 to free it)
+// Returns: void *, the block (it may have moved), or NULL if there was no room
+// for it (the block is left as it was)
+void *brealloc(Balloc pool, void *mem, size_t size)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Outputting error message
+        fprintf(stderr, "Pool does not exist!\n");
+        exit(1);
+    }
+
+    // Nothing to resize, so it is a new block
+    if (!mem)
+    {
+        return balloc(pool, size);
+    }
+
+    // Resized to nothing, so it is freed
+    if (size < 1)
+    {
+        bfree(pool, mem);
+        return NULL;
+    }
+
+    // Grab the representation of the pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // Grabbing the size of the block, this also verifies it is allocated
+    const size_t oldSize = bsize(pool, mem);
+    const int inPool = bowns(pool, mem);
+
+    // Too big for the pool before and after, the mapping is resized
+    if (!inPool && size > e2size(ballocPool->managementData[1]))
+    {
+        return largerealloc(&ballocPool->larges, mem, size);
+    }
+
+    // Resizing it where it is (in the arena it came from for a pool with arenas)
+    if (inPool && size <= e2size(ballocPool->managementData[1]))
+    {
+        Rep *owner = ballocPool->arenaCount ? ownerarena(ballocPool, mem) : ballocPool;
+        if (resizeblock(owner, mem, size))
+        {
+            return mem;
+        }
+    }
+
+    // Moving it to a block of the new size (a mapped block that now fits in the
+    // pool is moved back in, but stays where it is if the pool has no room)
+    void *newMem = balloc(pool, size);
+    if (newMem == NULL)
+    {
+        return size <= oldSize ? mem : NULL;
+    }
+
+    memcpy(newMem, mem, size < oldSize ? size : oldSize);
+    bfree(pool, mem);
+
+    return newMem;
+}
+
+// Checks if an address is inside the range a pool hands blocks out of
+// (the whole reserved range for growable pools), without looking at any block
+// so it is cheap enough to pick which of several pools to free a block to
+// pool = A Balloc struct that contains the memory map
+// * mem = The address
+// Returns: int, nonzero if the address belongs to the pool
+int bowns(Balloc pool, void *mem)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Outputting error message
+        fprintf(stderr, "Pool does not exist!\n");
+        exit(1);
+    }
+
+    // Grab the representation of the pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // A pool with arenas owns whatever one of its arenas does
+    if (ballocPool->arenaCount)
+    {
+        return findarena(ballocPool, mem) != NULL;
+    }
+
+    return (char *)mem >= (char *)ballocPool->pool && (char *)mem < (char *)ballocPool->pool + ballocPool->limit;
+}
+
 // A tool to output a text representation of the memory pool to stdout
 // which is primarily a tool for debugging
 // pool = A Balloc struct that contains the memory map
@@ -393,6 +1277,17 @@ void bprint(Balloc pool)
     // Note: The data in this balloc should be already good to go
     Rep *ballocPool = (Rep *)pool;
 
+    // A pool with arenas outputs every arena
+    if (ballocPool->arenaCount)
+    {
+        fprintf(stdout, "Arenas: %d\n", ballocPool->arenaCount);
+        for (int i = 0; i < ballocPool->arenaCount; i++)
+        {
+            bprint(ballocPool->arenas[i]);
+        }
+        return;
+    }
+
     // 3 Big things need to be output
     // 1. Base Address
     // 2. Management Data (Bounds, Range, Size)
@@ -411,13 +1306,13 @@ void bprint(Balloc pool)
     int lower = ballocPool->managementData[0];
     int upper = ballocPool->managementData[1];
     int range = ballocPool->managementData[2];
-    int size = ballocPool->size;
+    size_t size = ballocPool->size;
 
     // Outputting management data
     fprintf(stdout, "Lower Bounds (2^N): %d\n", lower);
     fprintf(stdout, "Upper Bounds (2^N): %d\n", upper);
     fprintf(stdout, "Range (Lower-Upper): %d\n", range);
-    fprintf(stdout, "Size of Pool: %d\n", size);
+    fprintf(stdout, "Size of Pool: %zu\n", size);
 
     // Whitespace
     fprintf(stdout, "--------------------------\n");
@@ -434,3 +1329,176 @@ void bprint(Balloc pool)
 
     return;
 }
+
+// Sets how many freed blocks of an order the pool keeps without merging them
+// The next allocations of that size take them back without splitting anything,
+// more than that are merged as usual, and all of them are merged as soon as
+// an allocation finds no block big enough (set it before threads share the pool)
+// pool = A Balloc struct that contains the memory map
+// e = The order, from l to u
+// slack = How many blocks to keep, 0 to always merge right away
+void bsetslack(Balloc pool, int e, size_t slack)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Outputting error message
+        fprintf(stderr, "Pool does not exist!\n");
+        exit(1);
+    }
+
+    // Grab the representation of the pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // Verify the order
+    if (e < ballocPool->managementData[0] || e > ballocPool->managementData[1])
+    {
+        // Outputting error message
+        fprintf(stderr, "Order is not in the pool's bounds!\n");
+        exit(1);
+    }
+
+    // A pool with arenas sets it for every arena
+    if (ballocPool->arenaCount)
+    {
+        for (int i = 0; i < ballocPool->arenaCount; i++)
+        {
+            bsetslack(ballocPool->arenas[i], e, slack);
+        }
+        return;
+    }
+
+    freelistslack(ballocPool->freeList, e, slack);
+}
+
+// Sets how many blocks of an order the pool makes at once when it has none
+// A block that holds that many is cut up in one go (rather than split down for
+// every allocation) and the ones not handed out wait for the next allocations
+// of the size, when no block that big is free the pool splits as usual
+// (set it before threads share the pool, lock-free pools do not refill)
+// pool = A Balloc struct that contains the memory map
+// e = The order, from l to u
+// n = How many blocks (rounded up to a power of 2, at most what a 2^u block holds), 1 to split one at a time
+void bsetrefill(Balloc pool, int e, size_t n)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Outputting error message
+        fprintf(stderr, "Pool does not exist!\n");
+        exit(1);
+    }
+
+    // Grab the representation of the pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // Verify the order
+    if (e < ballocPool->managementData[0] || e > ballocPool->managementData[1])
+    {
+        // Outputting error message
+        fprintf(stderr, "Order is not in the pool's bounds!\n");
+        exit(1);
+    }
+
+    // A pool with arenas sets it for every arena
+    if (ballocPool->arenaCount)
+    {
+        for (int i = 0; i < ballocPool->arenaCount; i++)
+        {
+            bsetrefill(ballocPool->arenas[i], e, n);
+        }
+        return;
+    }
+
+    freelistrefill(ballocPool->freeList, e, n);
+}
+
+// Sets the function called when the pool can not satisfy an allocation
+// It can free blocks, grow caches elsewhere, etc. and returns nonzero to
+// have the allocation retried, or 0 to have balloc() return NULL
+// pool = A Balloc struct that contains the memory map
+// handler = The out of memory handler (NULL to remove it)
+// * arg = Passed along to the handler
+void bsethandler(Balloc pool, BallocHandler handler, void *arg)
+{
+
+    // Verify pool
+    if (!pool)
+    {
+        // Pool does not exist
+
+        // Outputting error message
+        fprintf(stderr, "Pool does not exist!\n");
+        exit(1);
+    }
+
+    // Grab the representation of the pool
+    Rep *ballocPool = (Rep *)pool;
+
+    // Saving the handler
+    ballocPool->handler = handler;
+    ballocPool->handlerArg = arg;
+}
+
+// Takes or gives back every lock of a pool and of its arenas
+// * ballocPool = The pool
+// lock = 1 to take them, 0 to give them back
+static void lockpool(Rep *ballocPool, int lock)
+{
+    for (int i = 0; i < ballocPool->arenaCount; i++)
+    {
+        lockpool(ballocPool->arenas[i], lock);
+    }
+
+    if (ballocPool->freeList)
+    {
+        if (lock)
+        {
+            freelistlockall(ballocPool->freeList);
+        }
+        else
+        {
+            freelistunlockall(ballocPool->freeList);
+        }
+    }
+}
+
+// Takes every lock the pools (and the caches and blocks of all pools) use, so
+// fork() can be called without the child inheriting a lock held by another thread
+// Call it right before fork() with every pool the process uses, and bunlockall()
+// with the same pools right after it in both the parent and the child
+// ** pools = The pools
+// n = How many pools there are
+void blockall(Balloc *pools, int n)
+{
+    // Thread caches are flushed with the cache lock held, so it goes first
+    cachelockall();
+
+    for (int i = 0; i < n; i++)
+    {
+        lockpool((Rep *)pools[i], 1);
+    }
+
+    largelockall();
+}
+
+// Gives back every lock blockall() took
+// ** pools = The pools given to blockall()
+// n = How many pools there are
+void bunlockall(Balloc *pools, int n)
+{
+    largeunlockall();
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        lockpool((Rep *)pools[i], 0);
+    }
+
+    cacheunlockall();
+}
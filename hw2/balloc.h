@@ -1,15 +1,52 @@
 #ifndef BALLOC_H
 #define BALLOC_H
 
+#include <stddef.h>
+
 typedef void *Balloc;
 
-extern Balloc bcreate(unsigned int size, int l, int u);
+// bcreatex() flags
+// The pool starts at size and grows (within a reserved range of limit bytes) as it runs out
+#define BALLOC_GROWABLE 0x1
+// Threads can share the pool, every order level has its own lock
+#define BALLOC_THREADSAFE 0x2
+// Every thread keeps a small cache of free blocks per order (implies BALLOC_THREADSAFE)
+#define BALLOC_CACHED 0x4
+// Every order level is a lock-free stack and merging is put off until the pool
+// runs dry, so threads never wait on each other to allocate or free
+#define BALLOC_LOCKFREE 0x8
+// bcreatearenas() binds each call to the arena of the CPU it runs on instead of one arena per thread
+#define BALLOC_PERCPU 0x10
+// Freed blocks are not merged right away, every order keeps some for reuse (see bsetslack())
+#define BALLOC_LAZY 0x20
+// Every order hands out its lowest free block first, found through a bitmap tree in O(log n)
+// (ignored with BALLOC_LOCKFREE)
+#define BALLOC_ORDERED 0x40
+
+// Called when a pool can not satisfy an allocation, it can free memory (or
+// give up) and returns nonzero to have the allocation tried again
+typedef int (*BallocHandler)(Balloc pool, size_t size, void *arg);
+
+extern Balloc bcreate(size_t size, int l, int u);
+extern Balloc bcreatex(size_t size, int l, int u, size_t limit, int flags);
+extern Balloc bcreatearenas(size_t size, int l, int u, size_t limit, int flags, int n);
 extern void   bdelete(Balloc pool);
 
-extern void *balloc(Balloc pool, unsigned int size);
+extern void *balloc(Balloc pool, size_t size);
+extern void *ballocalign(Balloc pool, size_t size, size_t align);
+extern size_t ballocn(Balloc pool, size_t size, size_t n, void **blocks);
 extern void  bfree(Balloc pool, void *mem);
+extern void  bfreen(Balloc pool, void **blocks, size_t n);
+extern void *brealloc(Balloc pool, void *mem, size_t size);
 
-extern unsigned int bsize(Balloc pool, void *mem);
+extern size_t bsize(Balloc pool, void *mem);
+extern int    bowns(Balloc pool, void *mem);
 extern void bprint(Balloc pool);
 
+extern void bsethandler(Balloc pool, BallocHandler handler, void *arg);
+extern void blockall(Balloc *pools, int n);
+extern void bunlockall(Balloc *pools, int n);
+extern void bsetslack(Balloc pool, int e, size_t slack);
+extern void bsetrefill(Balloc pool, int e, size_t n);
+
 #endif
@@ -44,6 +44,25 @@ extern BBM bbmcreate(size_t size, int e)
   return bmcreate(mapsize(size, e));
 }
 
+// Gets how many bytes a buddy bit map takes up
+// size = The size of the pool
+// e = Size of the block exponent
+// Returns: size_t, the number of bytes bbmplace() needs
+extern size_t bbmspace(size_t size, int e)
+{
+  return bmspace(mapsize(size, e));
+}
+
+// Creates a buddy bit map inside memory the caller already owns
+// * p = bbmspace(size, e) bytes of zeroed memory
+// size = The size of the pool
+// e = Size of the block exponent
+// Returns: BBM, a buddy bit map that goes away with p
+extern BBM bbmplace(void *p, size_t size, int e)
+{
+  return bmplace(p, mapsize(size, e));
+}
+
 // Deletes a buddy bit map
 // b = The buddy bit map to be deleted
 extern void bbmdelete(BBM b)
@@ -82,6 +101,19 @@ extern int bbmtst(BBM b, void *base, void *mem, int e)
   return bmtst(b, bitaddr(base, mem, e));
 }
 
+// Inverts the bit at a provided address using the normal bit map function
+// Used as an "exactly one of the pair is free" toggle, flipped every time
+// either buddy of the pair enters or leaves the free list
+// b = A buddy bit map
+// * base = The base address of the memory pool
+// * mem = The address of where the operation to occur
+// e = Size of the block exponent
+// Returns: int, 1 if exactly one buddy is free, 0 if both or neither are
+extern int bbminv(BBM b, void *base, void *mem, int e)
+{
+  return bminv(b, bitaddr(base, mem, e));
+}
+
 // Outputs the buddy bit map
 // b = A buddy bit map
 extern void bbmprt(BBM b)
@@ -96,7 +128,7 @@ extern void bbmprt(BBM b)
 // Returns: void *,
 extern void *baddrset(void *base, void *mem, int e)
 {
-  unsigned int mask = 1 << e;
+  size_t mask = (size_t)1 << e;
   return base + ((mem - base) | mask);
 }
 
@@ -107,7 +139,7 @@ extern void *baddrset(void *base, void *mem, int e)
 // Returns: void *,
 extern void *baddrclr(void *base, void *mem, int e)
 {
-  unsigned int mask = ~(1 << e);
+  size_t mask = ~((size_t)1 << e);
   return base + ((mem - base) & mask);
 }
 
@@ -118,7 +150,7 @@ extern void *baddrclr(void *base, void *mem, int e)
 // Returns: void *,
 extern void *baddrinv(void *base, void *mem, int e)
 {
-  unsigned int mask = 1 << e;
+  size_t mask = (size_t)1 << e;
   return base + ((mem - base) ^ mask);
 }
 
@@ -129,6 +161,6 @@ extern void *baddrinv(void *base, void *mem, int e)
 // Returns: int, 1 for pass 0 for nope
 extern int baddrtst(void *base, void *mem, int e)
 {
-  unsigned int mask = 1 << e;
-  return (mem - base) & mask;
+  size_t mask = (size_t)1 << e;
+  return ((mem - base) & mask) != 0;
 }
@@ -8,11 +8,14 @@
 typedef void *BBM;
 
 extern BBM  bbmcreate(size_t size, int e);
+extern size_t bbmspace(size_t size, int e);
+extern BBM  bbmplace(void *p, size_t size, int e);
 extern void bbmdelete(BBM b);
 
 extern void bbmset(BBM b, void *base, void *mem, int e);
 extern void bbmclr(BBM b, void *base, void *mem, int e);
 extern  int bbmtst(BBM b, void *base, void *mem, int e);
+extern  int bbminv(BBM b, void *base, void *mem, int e);
 
 extern void bbmprt(BBM b);
 
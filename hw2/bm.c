@@ -50,7 +50,7 @@ extern BM bmcreate(size_t bits)
 {
   size_t bytes = bits2bytes(bits);
   size_t *p = mmalloc(sizeof(size_t) + bytes);
-  if ((long)p == -1)
+  if (!p)
     return 0;
   *p = bits;
   BM b = ++p;
@@ -58,13 +58,32 @@ extern BM bmcreate(size_t bits)
   return b;
 }
 
+// Gets how many bytes a BitMap of a given size takes up, including its header
+// bits = the size the BitMap should be
+// Returns: size_t, the number of bytes bmplace() needs
+extern size_t bmspace(size_t bits)
+{
+  return sizeof(size_t) + bits2bytes(bits);
+}
+
+// Creates a BitMap inside memory the caller already owns
+// * p = bmspace(bits) bytes of zeroed memory (such as fresh mmap memory)
+// bits = the size the BitMap should be
+// Returns: BM, a regular bitmap (it is not deleted, it goes away with p)
+extern BM bmplace(void *p, size_t bits)
+{
+  size_t *header = p;
+  *header = bits;
+  return ++header;
+}
+
 // Deletes the BitMap
 // b = a BitMap
 extern void bmdelete(BM b)
 {
   size_t *p = b;
   p--;
-  mmfree(p, *p);
+  mmfree(p, sizeof(size_t) + bits2bytes(*p));
 }
 
 // Sets a bit on the BitMap at a given location
@@ -94,6 +113,17 @@ extern int bmtst(BM b, size_t i)
   return bittst(b + i / bitsperbyte, i % bitsperbyte);
 }
 
+// Inverts the bit on the BitMap at a given location
+// b = a BitMap
+// i = offset value, simliar to indexing
+// Returns: int, the value of the bit after it was inverted
+extern int bminv(BM b, size_t i)
+{
+  ok(b, i);
+  bitinv(b + i / bitsperbyte, i % bitsperbyte);
+  return bittst(b + i / bitsperbyte, i % bitsperbyte);
+}
+
 // An outputting function of the BitMap
 // b = a BitMap
 // extern void bmprt(BM b)
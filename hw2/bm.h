@@ -8,11 +8,14 @@
 typedef void *BM;
 
 extern BM   bmcreate(size_t bits);
+extern size_t bmspace(size_t bits);
+extern BM   bmplace(void *p, size_t bits);
 extern void bmdelete(BM b);
 
 extern void bmset(BM b, size_t i);
 extern void bmclr(BM b, size_t i);
 extern int  bmtst(BM b, size_t i);
+extern int  bminv(BM b, size_t i);
 
 extern void bmprt(BM b);
 
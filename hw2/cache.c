@@ -0,0 +1,410 @@
+/**
+ * Per thread caches of free blocks for the balloc module.
+ *
+ * Every thread that uses a cached pool gets its own stash of free blocks for
+ * each order, a freed block is pushed on the stash and an allocation pops it
+ * back off without taking a lock. Stashes are refilled from and flushed to
+ * the freelist half of a stash at a time, and flushed when the thread exits.
+ *
+ * @version 1.0
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cache.h"
+#include "freelist.h"
+#include "utils.h"
+
+// Most bytes a thread keeps cached for one order of one pool
+#define STASH_BYTES 32768
+
+// Most blocks a thread keeps cached for one order (so small orders do not hold thousands)
+#define STASH_BLOCKS 64
+
+// The free blocks a thread has cached for one order
+// The blocks are linked through their first word
+struct Stash
+{
+
+    // Most recently freed block (NULL when the stash is empty)
+    void *head;
+
+    // How many blocks are on it, and how many it can hold (0 if the order is not cached)
+    int count;
+    int capacity;
+
+} typedef Stash;
+
+// One thread's cache for one pool
+struct Cache
+{
+
+    // The pool's caches this belongs to, NULL once the pool is deleted
+    Caches *owner;
+
+    // Where blocks come from and go back to
+    FreeList freeList;
+    void *base;
+    int lower;
+    int upper;
+
+    // The other caches of the same thread
+    struct Cache *nextOfThread;
+
+    // The other caches of the same pool (only changed with the registry lock held)
+    struct Cache *nextOfPool;
+    struct Cache *prevOfPool;
+
+    // Size of the mapping the cache lives in
+    size_t mappedSize;
+
+    // A stash for every order from lower to upper, indexed by exponent - lower
+    Stash stashes[];
+
+} typedef Cache;
+
+// The caches of the calling thread, most recently used first
+// (initial-exec, so a preloaded library does not call malloc() to reach it)
+static __thread Cache *threadCaches __attribute__((tls_model("initial-exec")));
+
+// Used to flush a thread's caches when it exits
+static pthread_key_t threadKey;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+
+// Guards every pool's list of caches, and a cache's owner
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Gives blocks on a stash back to the freelist until only some are left
+// They are freed as one batch, sorted by address so buddies merge with each other first
+// @param *cache = The cache
+// @param e = The order of the stash
+// @param keep = How many blocks to leave on the stash
+static void flushstash(Cache *cache, int e, int keep)
+{
+    // Grabbing the stash
+    Stash *stash = &cache->stashes[e - cache->lower];
+    void *blocks[STASH_BLOCKS];
+    size_t n = 0;
+
+    while (stash->count > keep)
+    {
+        // Pop the block, it is allocated again until the batch is freed
+        void *block = stash->head;
+        stash->head = *(void **)block;
+        stash->count--;
+
+        freelistmark(cache->freeList, cache->base, block, e, cache->lower);
+        blocks[n++] = block;
+    }
+
+    qsort(blocks, n, sizeof(void *), compareaddresses);
+    freelistfreen(cache->freeList, cache->base, blocks, n, cache->lower);
+}
+
+// Gives every cached block back to the freelist
+// @param *cache = The cache
+static void flushall(Cache *cache)
+{
+    for (int i = cache->lower; i <= cache->upper; i++)
+    {
+        flushstash(cache, i, 0);
+    }
+}
+
+// Unlinks a cache from its pool's list (registry lock held)
+// @param *cache = The cache
+static void unregister(Cache *cache)
+{
+    if (cache->prevOfPool)
+    {
+        cache->prevOfPool->nextOfPool = cache->nextOfPool;
+    }
+    else
+    {
+        *cache->owner = cache->nextOfPool;
+    }
+
+    if (cache->nextOfPool)
+    {
+        cache->nextOfPool->prevOfPool = cache->prevOfPool;
+    }
+
+    __atomic_store_n(&cache->owner, NULL, __ATOMIC_RELEASE);
+}
+
+// Flushes and throws away a thread's caches when it exits
+// @param *arg = Not used, the caches are in the thread's own variable
+static void threadexit(void *arg)
+{
+    // Grabbing the thread's caches
+    Cache *cache = threadCaches;
+    threadCaches = NULL;
+
+    while (cache)
+    {
+        Cache *next = cache->nextOfThread;
+
+        // The pool may be getting deleted by another thread, so its caches are locked
+        pthread_mutex_lock(&registryLock);
+        if (cache->owner)
+        {
+            flushall(cache);
+            unregister(cache);
+        }
+        pthread_mutex_unlock(&registryLock);
+
+        mmfree(cache, cache->mappedSize);
+        cache = next;
+    }
+}
+
+// Creates the key whose destructor flushes a thread's caches
+static void makekey()
+{
+    pthread_key_create(&threadKey, threadexit);
+}
+
+// Makes a cache for the calling thread and a pool
+// @param *caches = The pool's caches
+// @param f = The pool's freelist
+// @param *base = The base address of the pool
+// @param l = Lower exponent bound
+// @param u = Upper exponent bound
+// @return Returns: Cache *, the new cache (first on the thread's list), or NULL if it could not be mapped
+static Cache *makecache(Caches *caches, FreeList f, void *base, int l, int u)
+{
+    // Mapping the cache with room for a stash per order
+    size_t mappedSize = sizeof(Cache) + (u - l + 1) * sizeof(Stash);
+    Cache *cache = mmalloc(mappedSize);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->freeList = f;
+    cache->base = base;
+    cache->lower = l;
+    cache->upper = u;
+    cache->mappedSize = mappedSize;
+
+    // Every order holds up to STASH_BYTES, orders that would only hold one block are not cached
+    for (int i = l; i <= u; i++)
+    {
+        size_t capacity = STASH_BYTES >> i;
+        capacity = capacity > STASH_BLOCKS ? STASH_BLOCKS : capacity;
+        cache->stashes[i - l].capacity = capacity < 2 ? 0 : capacity;
+    }
+
+    // Adding it to the pool's caches
+    pthread_mutex_lock(&registryLock);
+    cache->owner = caches;
+    cache->nextOfPool = *caches;
+    if (*caches)
+    {
+        ((Cache *)*caches)->prevOfPool = cache;
+    }
+    *caches = cache;
+    pthread_mutex_unlock(&registryLock);
+
+    // Adding it to the thread's caches, and making sure they are flushed when it exits
+    cache->nextOfThread = threadCaches;
+    threadCaches = cache;
+    pthread_once(&threadKeyOnce, makekey);
+    pthread_setspecific(threadKey, &threadCaches);
+
+    return cache;
+}
+
+// Finds the calling thread's cache for a pool, throwing away caches of deleted pools on the way
+// @param *caches = The pool's caches
+// @return Returns: Cache *, the cache (moved to the front of the thread's list), or NULL if there is none
+static Cache *findcache(Caches *caches)
+{
+    // Most of the time it is the one that was used last
+    Cache *cache = threadCaches;
+    if (cache && __atomic_load_n(&cache->owner, __ATOMIC_ACQUIRE) == caches)
+    {
+        return cache;
+    }
+
+    // Otherwise walk the thread's caches
+    Cache **link = &threadCaches;
+    while ((cache = *link))
+    {
+        Caches *owner = __atomic_load_n(&cache->owner, __ATOMIC_ACQUIRE);
+
+        if (owner == NULL)
+        {
+            // Its pool was deleted (and nothing else refers to it anymore)
+            *link = cache->nextOfThread;
+            mmfree(cache, cache->mappedSize);
+            continue;
+        }
+
+        if (owner == caches)
+        {
+            // Move it to the front for next time
+            *link = cache->nextOfThread;
+            cache->nextOfThread = threadCaches;
+            threadCaches = cache;
+            return cache;
+        }
+
+        link = &cache->nextOfThread;
+    }
+
+    return NULL;
+}
+
+// Allocates a block through the calling thread's cache
+// An empty stash is refilled with half of its capacity at once
+// @param *caches = The pool's caches
+// @param f = The pool's freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param l = Lower exponent bound
+// @param u = Upper exponent bound
+// @return Returns: void *, the block, or NULL if the pool is out of memory for this size
+void *cachealloc(Caches *caches, FreeList f, void *base, int e, int l, int u)
+{
+    // Grabbing the thread's cache for the pool
+    Cache *cache = findcache(caches);
+    if (cache == NULL)
+    {
+        cache = makecache(caches, f, base, l, u);
+    }
+
+    // Without a cache (there was no memory for one) the freelist is used directly
+    if (cache == NULL)
+    {
+        return freelistalloc(f, base, e, l);
+    }
+
+    // Grabbing the stash for the order
+    Stash *stash = &cache->stashes[e - l];
+
+    // Orders that are not cached go straight to the freelist
+    if (stash->capacity == 0)
+    {
+        return freelistalloc(f, base, e, l);
+    }
+
+    // A block is cached, no lock needed
+    if (stash->head)
+    {
+        void *block = stash->head;
+        stash->head = *(void **)block;
+        stash->count--;
+
+        // It is allocated again
+        freelistmark(f, base, block, e, l);
+        return block;
+    }
+
+    // Empty, get a block from the freelist and fill half the stash while at it, as one batch
+    void *blocks[STASH_BLOCKS];
+    size_t n = freelisttake(f, base, e, l, stash->capacity / 2 + 1, blocks);
+    if (n == 0)
+    {
+        return NULL;
+    }
+
+    // The first one is handed out, the others are cached highest address first, so the lowest comes out next
+    for (size_t i = n - 1; i > 0; i--)
+    {
+        // Cached blocks are not allocated as far as the freelist can tell
+        freelistmark(f, base, blocks[i], -1, l);
+        *(void **)blocks[i] = stash->head;
+        stash->head = blocks[i];
+        stash->count++;
+    }
+
+    return blocks[0];
+}
+
+// Frees a block through the calling thread's cache
+// A full stash gives half of its blocks back to the freelist first
+// @param *caches = The pool's caches
+// @param f = The pool's freelist
+// @param *base = The base address of the pool
+// @param *mem = The block (already checked to be allocated)
+// @param e = Exponent of the block
+// @param l = Lower exponent bound
+// @param u = Upper exponent bound
+void cachefree(Caches *caches, FreeList f, void *base, void *mem, int e, int l, int u)
+{
+    // Grabbing the thread's cache for the pool
+    Cache *cache = findcache(caches);
+    if (cache == NULL)
+    {
+        cache = makecache(caches, f, base, l, u);
+    }
+
+    // Without a cache (there was no memory for one) the freelist is used directly
+    if (cache == NULL)
+    {
+        freelistfree(f, base, mem, e, l);
+        return;
+    }
+
+    // Grabbing the stash for the order
+    Stash *stash = &cache->stashes[e - l];
+
+    // Orders that are not cached go straight to the freelist
+    if (stash->capacity == 0)
+    {
+        freelistfree(f, base, mem, e, l);
+        return;
+    }
+
+    // Full, make room
+    if (stash->count == stash->capacity)
+    {
+        flushstash(cache, e, stash->capacity / 2);
+    }
+
+    // Not allocated anymore (so freeing it twice is still caught)
+    freelistmark(f, base, mem, -1, l);
+    *(void **)mem = stash->head;
+    stash->head = mem;
+    stash->count++;
+}
+
+// Takes the lock that guards every pool's caches (before any freelist lock, a
+// thread that exits flushes its caches while holding it)
+void cachelockall()
+{
+    pthread_mutex_lock(&registryLock);
+}
+
+// Gives back the lock cachelockall() took
+void cacheunlockall()
+{
+    pthread_mutex_unlock(&registryLock);
+}
+
+// Gives everything the calling thread has cached for a pool back to it
+// @param *caches = The pool's caches
+void cacheflush(Caches *caches)
+{
+    Cache *cache = findcache(caches);
+    if (cache)
+    {
+        flushall(cache);
+    }
+}
+
+// Cuts a pool off from its caches before the pool is deleted
+// (the caches are thrown away by their threads later)
+// @param *caches = The pool's caches
+void cachedetach(Caches *caches)
+{
+    pthread_mutex_lock(&registryLock);
+    while (*caches)
+    {
+        unregister((Cache *)*caches);
+    }
+    pthread_mutex_unlock(&registryLock);
+}
@@ -0,0 +1,18 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "freelist.h"
+
+// A pool's caches are found through the address of a void * the pool owns
+// (NULL when no thread has a cache for the pool yet)
+typedef void *Caches;
+
+extern void *cachealloc(Caches *caches, FreeList f, void *base, int e, int l, int u);
+extern void  cachefree(Caches *caches, FreeList f, void *base, void *mem, int e, int l, int u);
+
+extern void cacheflush(Caches *caches);
+extern void cachelockall();
+extern void cacheunlockall();
+extern void cachedetach(Caches *caches);
+
+#endif
@@ -8,29 +8,78 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "freelist.h"
 #include "utils.h"
 #include "bbm.h"
+#include "obm.h"
 
 // You can request up to 2^50
 #define MAX_ORDER 50
 
-// A singly linked list that represents the blocks of memory for the index and its size
+// A lock-free stack head is a block index (offset >> l, plus 1 so 0 is empty)
+// in the low bits, and a tag that changes on every push and pop in the high
+// bits, so a head that was popped and pushed back in between does not match
+// The index only takes the bits the pool's limit needs and the tag gets the
+// rest, never fewer than 64 - STACK_INDEX_BITS. A stale head can only match
+// again if the tag wraps: a thread would have to stall between reading the
+// head and swapping it while a multiple of 2^32 (or more) pushes and pops
+// happen on that level, and then find the same block on top. So a wrap is
+// not a practical concern
+#define STACK_INDEX_BITS 32
+
+// Set in the order table entry of an allocated block that was queued to be
+// freed later (by another thread), the exponent stays under it
+// (exponents stop at MAX_ORDER, so it never clashes with one)
+#define ORDER_QUEUED 0x80
+
+// A doubly linked list node that represents a free block of memory
+// The node is stored inside the free block itself, so the address of the
+// node is the address of the block and no extra memory is mapped for it
 struct Buddy
 {
 
-    // Holding levels bitmap in the freelist
-    BBM bitmap;
-
-    // Storing current address
-    void *currentLocation;
-
-    // Storing location pointer for a singly linked list
+    // Storing location pointer for the next free block on the level
     struct Buddy *nextBuddy;
 
+    // Storing location pointer for the previous free block on the level
+    // (allows a buddy to be unlinked without walking the list)
+    struct Buddy *prevBuddy;
+
 } typedef Buddy;
 
+// One level of the freelist, on its own cache line so threads working
+// on different levels do not fight over the same line
+struct __attribute__((aligned(64))) Level
+{
+
+    // Storing the head of the level's list (NULL when the level is empty)
+    Buddy *head;
+
+    // Guards the list and the level's pair bitmap (only used when the freelist is locked)
+    pthread_mutex_t lock;
+
+    // The tagged head of the level's stack, used instead of head when the freelist is lock-free
+    uint64_t stack;
+
+    // Blocks that were freed without being merged, linked through nextBuddy
+    // Their pair bits still say they are allocated, so nothing merges with them
+    // until they are freed for real (when the pool runs short)
+    Buddy *lazy;
+
+    // How many blocks are on it, and how many freeing may put on it (0 to always merge right away)
+    size_t lazyCount;
+    size_t slack;
+
+    // When the level is empty it is refilled by cutting a whole block of this
+    // order into blocks of the level's size (0 to split one block at a time)
+    int refillOrder;
+
+} typedef Level;
+
 // A freelist struct
 struct freeListList
 {
@@ -38,191 +87,217 @@ struct freeListList
     // Pool of the allocator
     void *baseAddress;
 
-    // Storing all the buddies up to a maximum of 10
-    Buddy *buddies[MAX_ORDER];
+    // Storing every level's list and its lock
+    Level levels[MAX_ORDER + 1];
 
-    // Another item that will set the [0] l: lowest power, [1] u: highest power, [2] r: number of buddies (u - l + 1)
-    int managementData[3];
+    // Storing every level's pair bitmap, a bit is set while exactly one buddy of the pair is free
+    // (only levels l to u-1 have one, the highest blocks are never merged)
+    BBM pairmaps[MAX_ORDER + 1];
 
-} typedef List;
+    // Storing every level's free blocks as an ordered bitmap when the freelist is address ordered
+    // (used instead of the level's list, so the lowest free block is always taken first)
+    OBM freemaps[MAX_ORDER + 1];
 
-// Builds a list of free blocks from the root node
-// @param rootNode = The start of the singly linked list
-// @param numberOfBlocks = How many blocks should be appended to the list
-// @param blockSize = The size of the block to create
-// @param *base = The base address of the memory pool
-void buildlist(Buddy *rootNode, size_t numberOfBlocks, int blockExponent, void *base, BBM bitmap)
-{
+    // Storing the exponent + 1 of every allocated block, one byte per smallest block
+    // indexed by (mem - base) >> l (0 for anything that is not the start of an allocated block,
+    // ORDER_QUEUED added while a block waits to be freed)
+    unsigned char *orders;
 
-    // Using this for looping purposes to keep appending nodes
-    Buddy *currentNode = rootNode;
+    // Size of the memory pool
+    size_t size;
 
-    // Holding the base address of the bitmap
-    // void *baseBBMAddress = buddyBitmap;
+    // Guards the wilderness, end and growing the pool (only used when the freelist is locked,
+    // a lock-free freelist moves the wilderness with compare and swap and only locks to grow)
+    // A level lock can be held while taking it, but never the other way around
+    pthread_mutex_t wildernessLock __attribute__((aligned(64)));
 
-    // Hodling the current address to the bit map
-    // void *currentBBMAddress = buddyBitmap;
+    // The wilderness, [wilderness, end) has never been handed out, it is used
+    // as a bump pointer whenever the requested level's list is empty
+    char *wilderness;
+    char *end;
 
-    // Holding the current address (initally starting with base)
-    void *currentAddress = base;
+    // A growable pool has [end, limit) reserved and commits it as it is needed
+    char *limit;
 
-    // Creating all the blocks, the blockSize should aleady be in bytes
-    for (int i = 0; i < numberOfBlocks; i++)
-    {
+    // Summary of the levels that have a free block, bit i is set while levels[i] is not empty
+    // (changed atomically, so it can be read without taking any lock)
+    uint64_t nonEmpty __attribute__((aligned(64)));
 
-        // Building list failed
-        if (!currentNode)
-        {
-            // Outputting error message
-            fprintf(stderr, "Building the initial buddy list failed!");
-            exit(1);
-        }
+    // How threads share the freelist (FREELIST_PLAIN, FREELIST_LOCKED or FREELIST_LOCKFREE)
+    int mode;
+
+    // How many low bits of a lock-free stack head are the index, and the mask for them
+    int stackBits;
+    uint64_t stackMask;
+
+    // How many blocks are on the lazy lists of all the levels together
+    // (changed atomically, so running short can check it without taking any lock)
+    size_t lazyBlocks;
 
-        // Creating new block
-        Buddy *newBuddy = mmalloc(sizeof(Buddy));
+    // Merging a lock-free freelist is put off until it runs dry, then one thread
+    // merges everything while the others wait for the count to go up
+    pthread_mutex_t compactLock;
+    unsigned int compactions;
+
+    // Another item that will set the [0] l: lowest power, [1] u: highest power, [2] r: number of buddies (u - l + 1)
+    int managementData[3];
+
+} typedef List;
+
+// Gets the smallest exponent whose blocks can hold a free list node
+// @return Returns: int, the smallest usable lower exponent bound
+int freelistminexponent()
+{
+    return size2e(sizeof(Buddy));
+}
 
-        // Getting new address using pointer arithmetic
-        void *newAddress = (void *)((char *)currentAddress + e2size(blockExponent));
+// Gets the largest exponent a freelist has a level for
+// @return Returns: int, the largest usable upper exponent bound
+int freelistmaxexponent()
+{
+    return MAX_ORDER;
+}
 
-        // Store the new current address
-        currentAddress = newAddress;
+// Gets the biggest pool a freelist can manage
+// @param l = Lower exponent bound
+// @param mode = How threads share the freelist
+// @return Returns: size_t, the most bytes the pool can have
+size_t freelistmaxsize(int l, int mode)
+{
+    // A lock-free stack has to fit a block index next to its tag
+    if (mode == FREELIST_LOCKFREE)
+    {
+        return ((((uint64_t)1 << STACK_INDEX_BITS) - 1) - 1) << l;
+    }
 
-        // Setting the current address to the new block
-        newBuddy->currentLocation = currentAddress;
+    return e2size(MAX_ORDER + 1);
+}
 
-        // Adding the bitmap to the new buddy
-        newBuddy->bitmap = bitmap;
+// Gets how much metadata a freelist needs: the List itself, a pair bitmap for
+// every level from l to u-1, an ordered bitmap for every level when the freelist
+// is address ordered and the order table, each on its own cache lines
+// @param size = The size of the memory pool to work with
+// @param l = Lower exponent bound
+// @param u = Upper exponent bound
+// @param ordered = Nonzero if the freelist will be address ordered
+// @return Returns: size_t, the number of bytes freelistcreate() needs for meta
+size_t freelistspace(size_t size, int l, int u, int ordered)
+{
+    // The List itself
+    size_t space = roundup(sizeof(List), cachelinesize);
 
-        // Appending new block
-        currentNode->nextBuddy = newBuddy;
+    // The pair bitmaps for the levels that can merge
+    for (int i = l; i < u; i++)
+    {
+        space += roundup(bbmspace(size, i), cachelinesize);
+    }
 
-        // Getting new currentNode
-        currentNode = currentNode->nextBuddy;
+    // The ordered bitmaps for every level
+    for (int i = l; ordered && i <= u; i++)
+    {
+        space += roundup(obmspace(size, i), cachelinesize);
     }
 
-    // Setting final block to point at NULL
-    currentNode->nextBuddy = NULL;
+    // The order table, one byte per smallest block
+    space += roundup(divup(size, e2size(l)), cachelinesize);
 
-    // List created!
-    return;
+    return space;
 }
 
 // Creates a freelist struct and returns the void *
 // @param size = The size of the memory pool to work with
+// @param limit = The size the pool may grow to (reserved but not committed past size),
+//                freelistspace() has to have been given this size
 // @param l = Lower exponent bound
 // @param u = Upper exponent bound
 // @param *base = The address of the memory pool base
+// @param *meta = freelistspace() bytes of zeroed, cache line aligned memory to build the freelist in
+// @param mode = FREELIST_PLAIN, FREELIST_LOCKED to guard the freelist with a lock per level,
+//               or FREELIST_LOCKFREE to make every level a lock-free stack so threads can share it
+// @param ordered = Nonzero to hand out the lowest free block of a level first (not for FREELIST_LOCKFREE),
+//                  freelistspace() has to have been told so
 // @return Returns: FreeList, a struct containing the information on what blocks are free
-FreeList freelistcreate(size_t size, int l, int u, void *base)
+FreeList freelistcreate(size_t size, size_t limit, int l, int u, void *base, void *meta, int mode, int ordered)
 {
 
     // Variables should be presumably safe as they are verified in bcreate()
     // Used for aliasing
-    const size_t sizeRequested = size;
+    // (the bitmaps and order table cover everything the pool could grow to)
+    const size_t sizeRequested = limit;
     const int lower = l, upper = u;
 
     // Calculating range
     const int range = lower - upper;
 
-    // Creating the freelist struct
-    List *newFreelist = mmalloc(sizeof(List));
-
-    // Creating a bit map (void *)
-    // Ex: Bitmap(64, 5)
-    // BBM newBitMap = bbmcreate(sizeRequested, upper);
+    // The freelist struct sits at the start of the metadata
+    // (it is zeroed, so every list starts out empty)
+    List *newFreelist = (List *)meta;
 
-    // Creating the pointers that will hold the lists
-    // Ex: lower = 4, upper = 6
-    // buddies[0] --> NULL
-    // buddies[1] --> NULL
-    // buddies[2] --> NULL
-    // buddies[3] --> NULL
-    // buddies[4] --> NULL (can be changed)
-    // buddies[5] --> NULL (can be changed)
-    // buddies[6] --> void *
-    // buddies[7] --> NULL
-    // buddies[8] --> NULL
-    // buddies[9] --> NULL
+    // Next free spot in the metadata
+    char *nextMeta = (char *)meta + roundup(sizeof(List), cachelinesize);
 
-    for (int i = 0; i <= MAX_ORDER; i++)
+    // Building a pair bitmap for each of the levels that can merge
+    for (int i = lower; i < upper; i++)
     {
+        newFreelist->pairmaps[i] = bbmplace(nextMeta, sizeRequested, i);
+        nextMeta += roundup(bbmspace(sizeRequested, i), cachelinesize);
+    }
 
-        // Build a bitmap for that level
-        BBM newBuddyBitmap = bbmcreate(sizeRequested, i);
-
-        if (i == upper)
-        {
-            // Highest value block
-            // This means you need to break down the size of the pool
-            // and create as many blocks of the highest size as you can
-
-            // Getting the size of the largest block
-            size_t largestBlockSize = e2size(upper);
-
-            // Getting the number of blocks based on the largest size Ex: (size / 2^U) = numberOfBlocks
-            size_t numberOfBlocks = divup(size, largestBlockSize);
-
-            // New list node
-            Buddy *biggestBuddy;
-
-            // Creating a new list node
-            biggestBuddy = mmalloc(sizeof(Buddy));
-
-            // Setting the address to the base of the pool
-            biggestBuddy->currentLocation = base;
-
-            // Initally setting the nextBuddy to null for now...
-            biggestBuddy->nextBuddy = NULL;
-
-            // Saving bitmap into the buddy
-            biggestBuddy->bitmap = newBuddyBitmap;
+    // Building an ordered bitmap for each level when the freelist is address ordered
+    for (int i = lower; ordered && i <= upper; i++)
+    {
+        newFreelist->freemaps[i] = obmplace(nextMeta, sizeRequested, i);
+        nextMeta += roundup(obmspace(sizeRequested, i), cachelinesize);
+    }
 
-            // Build the list!
-            buildlist(biggestBuddy, numberOfBlocks - 1, upper, base, newBuddyBitmap);
+    // The order table comes last (zeroed, so nothing is allocated yet)
+    newFreelist->orders = (unsigned char *)nextMeta;
 
-            // Save into the list
-            newFreelist->buddies[i] = biggestBuddy;
-        }
-        else
+    // Every list starts out empty and the whole pool is wilderness, so
+    // creating a freelist does not touch the pool no matter how big it is
+    // Ex: lower = 4, upper = 6
+    // levels[4] --> NULL
+    // levels[5] --> NULL
+    // levels[6] --> NULL (until the first allocation cuts a block off the wilderness)
+    newFreelist->wilderness = (char *)base;
+    newFreelist->end = (char *)base + size;
+    newFreelist->limit = (char *)base + limit;
+
+    // A lock-free stack index only needs the bits of the biggest index, the tag gets the rest
+    newFreelist->stackBits = 64 - __builtin_clzll((limit >> lower) + 1);
+    newFreelist->stackMask = ((uint64_t)1 << newFreelist->stackBits) - 1;
+
+    // Setting up the locks when threads will share the freelist
+    newFreelist->mode = mode;
+    if (mode == FREELIST_LOCKED)
+    {
+        for (int i = lower; i <= upper; i++)
         {
-            // Lower levels do not start with a pointer
-
-            // New list node
-            Buddy *buddy;
-
-            // Creating a new list node
-            buddy = mmalloc(sizeof(Buddy));
-
-            // Setting the address to the base of the pool (NULL because it isn't valid)
-            buddy->currentLocation = NULL;
-
-            // Since this buddy will not have a list built initially, it is pointing at nothing
-            buddy->nextBuddy = NULL;
-
-            // Saving bitmap into the buddy
-            buddy->bitmap = newBuddyBitmap;
-
-            // Save into the list
-            newFreelist->buddies[i] = buddy;
+            pthread_mutex_init(&newFreelist->levels[i].lock, NULL);
         }
     }
+    if (mode != FREELIST_PLAIN)
+    {
+        pthread_mutex_init(&newFreelist->wildernessLock, NULL);
+        pthread_mutex_init(&newFreelist->compactLock, NULL);
+    }
 
     // Saving management data in the free list
     newFreelist->managementData[0] = lower;
     newFreelist->managementData[1] = upper;
     newFreelist->managementData[2] = range;
 
-    // Saving base address into the free list
+    // Saving base address and size into the free list
     newFreelist->baseAddress = base;
-
-    // Save bitmap into the list
-    // newFreelist->BitMap = newBitMap;
+    newFreelist->size = sizeRequested;
 
     // Returning the freelist as a void pointer
     return (void *)newFreelist;
 }
 
 // Deletes a freelist
+// The metadata belongs to whoever handed it to freelistcreate(), so this only
+// empties the freelist out
 // @param f = A freelist
 // @param l = Lower exponent bound
 // @param u = Upper exponent bound
@@ -240,321 +315,514 @@ void freelistdelete(FreeList f, int l, int u)
         exit(1);
     }
 
-    // 2 Big things to delete
-    // 1. Bitmap
-    // 2. All of the buddies and their singly linked lists
-
-    // Grab the lists (array of pointers)
-    Buddy **buddies = list->buddies;
+    // NULL the bitmaps and the lists
+    for (int i = l; i <= u; i++)
+    {
+        list->pairmaps[i] = NULL;
+        list->freemaps[i] = NULL;
+        list->levels[i].head = NULL;
+        list->levels[i].lazy = NULL;
+        list->levels[i].lazyCount = 0;
+    }
 
-    // Freeing each buddy and their list
-    for (int i = 0; i < MAX_ORDER; i++)
+    // Tearing down the locks
+    if (list->mode == FREELIST_LOCKED)
     {
-        // Get the current buddy
-        Buddy *currentBuddy = buddies[i];
+        for (int i = l; i <= u; i++)
+        {
+            pthread_mutex_destroy(&list->levels[i].lock);
+        }
+    }
+    if (list->mode != FREELIST_PLAIN)
+    {
+        pthread_mutex_destroy(&list->wildernessLock);
+        pthread_mutex_destroy(&list->compactLock);
+    }
+    list->mode = FREELIST_PLAIN;
 
-        // Grab the bitmap
-        BBM currentBitmap = currentBuddy->bitmap;
+    // NULL the order table
+    list->orders = NULL;
+    list->nonEmpty = 0;
 
-        // Delete the bitmap
-        bbmdelete(currentBitmap);
+    // Freelist should be bon voyage!
+    return;
+}
+
+// Takes every lock of a freelist, so nothing is halfway changed while they are held
+// (taken in the order the freelist itself takes them: merging, the levels bottom up, then the wilderness)
+// @param f = A freelist
+void freelistlockall(FreeList f)
+{
+    List *list = (List *)f;
 
-        // NULL the bitmap
-        currentBitmap = NULL;
+    if (list->mode == FREELIST_PLAIN)
+    {
+        return;
+    }
 
-        // Loop through the whole singly linked list
-        while (currentBuddy)
+    pthread_mutex_lock(&list->compactLock);
+    if (list->mode == FREELIST_LOCKED)
+    {
+        for (int i = list->managementData[0]; i <= list->managementData[1]; i++)
         {
-            // Save next buddy before freeing the current one
-            Buddy *nextBuddy = currentBuddy->nextBuddy;
+            pthread_mutex_lock(&list->levels[i].lock);
+        }
+    }
+    pthread_mutex_lock(&list->wildernessLock);
+}
 
-            // Free the 'current' buddy
-            mmfree(currentBuddy, sizeof(Buddy));
+// Gives back every lock freelistlockall() took
+// @param f = A freelist
+void freelistunlockall(FreeList f)
+{
+    List *list = (List *)f;
 
-            // NULL out the buddy
-            currentBuddy = NULL;
+    if (list->mode == FREELIST_PLAIN)
+    {
+        return;
+    }
 
-            // Update the buddy to be freed
-            currentBuddy = nextBuddy;
+    pthread_mutex_unlock(&list->wildernessLock);
+    if (list->mode == FREELIST_LOCKED)
+    {
+        for (int i = list->managementData[1]; i >= list->managementData[0]; i--)
+        {
+            pthread_mutex_unlock(&list->levels[i].lock);
         }
     }
+    pthread_mutex_unlock(&list->compactLock);
+}
 
-    // Freeing the freelist
-    mmfree(f, sizeof(List));
-
-    // WHEN DELETING YOU NEED TO DEAL WITH THE POINTERS
-    f = NULL;
-
-    // Freelist should be bon voyage!
-    return;
+// Takes a level's lock (does nothing unless the freelist is locked)
+// @param *list = The freelist
+// @param exponent = The level
+void lockorder(List *list, int exponent)
+{
+    if (list->mode == FREELIST_LOCKED)
+    {
+        pthread_mutex_lock(&list->levels[exponent].lock);
+    }
 }
 
-// Checks if there is another node in the list
-// @param *currentBuddy = The buddy being checked
-// @return Returns: int, 1 for single, 0 for no
-int issingle(Buddy *currentBuddy)
+// Gives back a level's lock
+// @param *list = The freelist
+// @param exponent = The level
+void unlockorder(List *list, int exponent)
 {
-    // Is there a friend?
-    if (currentBuddy->nextBuddy != NULL)
+    if (list->mode == FREELIST_LOCKED)
     {
-        // Yay, friend
-        return 0;
+        pthread_mutex_unlock(&list->levels[exponent].lock);
     }
-    else
+}
+
+// Takes the wilderness lock (does nothing unless threads share the freelist)
+// @param *list = The freelist
+void lockwilderness(List *list)
+{
+    if (list->mode != FREELIST_PLAIN)
     {
-        // No friend
-        return 1;
+        pthread_mutex_lock(&list->wildernessLock);
     }
 }
 
-// Acts very similar to allocaion but is purely used by buildup() to remove a pair of nodes
-// @param *currentBuddy = The left buddy
-// @param **buddies = The array of buddy head nodes
-// @param *base = The base address of the pool
-// @param exponent = The block size exponent
-// @param atHead = flag for case if currentBuddy is at head of list
-void removenodepair(Buddy *currentBuddy, Buddy **buddies, void *base, int exponent, int atHead)
+// Gives back the wilderness lock
+// @param *list = The freelist
+void unlockwilderness(List *list)
 {
-    // This method is called when there is at least two nodes
-    // fprintf(stdout, "Removing node pair! Base address is: %p\n", currentBuddy->currentLocation);
+    if (list->mode != FREELIST_PLAIN)
+    {
+        pthread_mutex_unlock(&list->wildernessLock);
+    }
+}
 
-    // Address to lookfor
-    void *targetAddress = currentBuddy->currentLocation;
+// Reads where the wilderness starts without holding its lock
+// @param *list = The freelist
+// @return Returns: char *, the start of the wilderness (may move right after)
+char *peekwilderness(List *list)
+{
+    return __atomic_load_n(&list->wilderness, __ATOMIC_RELAXED);
+}
 
-    // Is the pair at the head
-    if (atHead)
-    {
-        // Deal with removing two nodes at the start of the list
-        // fprintf(stdout, "At the head!\n");
+// Moves the start of the wilderness (wilderness lock held)
+// @param *list = The freelist
+// @param *wilderness = The new start of the wilderness
+void setwilderness(List *list, char *wilderness)
+{
+    __atomic_store_n(&list->wilderness, wilderness, __ATOMIC_RELAXED);
+}
 
-        // Get the next buddy so it will be deleted as well
-        Buddy *nextBuddy = currentBuddy->nextBuddy;
+// Checks whether a level has a free block without taking its lock
+// @param *list = The freelist
+// @param exponent = The level
+// @return Returns: int, 1 if the level looked non empty
+int levelhasblock(List *list, int exponent)
+{
+    return (__atomic_load_n(&list->nonEmpty, __ATOMIC_RELAXED) >> exponent) & 1;
+}
 
-        // Free the block
-        mmfree(currentBuddy, sizeof(Buddy));
+// Gets the lock-free stack index of a block (its offset in smallest blocks, plus 1)
+// @param *list = The freelist
+// @param *mem = The block
+// @return Returns: uint64_t, the index
+uint64_t stackindex(List *list, void *mem)
+{
+    return ((uint64_t)((char *)mem - (char *)list->baseAddress) >> list->managementData[0]) + 1;
+}
 
-        // Save that block into the head of the list
-        buddies[exponent] = nextBuddy;
+// Gets the block a lock-free stack index stands for
+// @param *list = The freelist
+// @param index = The index (not 0)
+// @return Returns: void *, the block
+void *stackblock(List *list, uint64_t index)
+{
+    return (char *)list->baseAddress + ((index - 1) << list->managementData[0]);
+}
 
-        // Will the nextBuddy be the last node in the list
-        if (issingle(nextBuddy))
-        {
-            // Set that buddy to NULL
-            nextBuddy->currentLocation = NULL;
-        }
-        else
-        {
-            // Can free next buddy as well, but need to grab the nextBuddy's nextBuddy (a little confusing I know)
-            // Ex: [currentBuddy (TO BE FREED)]-->[nextBuddy (TO BE FREED)]-->[nextBuddy's nextBuddy]
-            Buddy *nextnextBuddy = nextBuddy->nextBuddy;
+// Builds the next head of a lock-free stack, the tag moves on every time
+// @param *list = The freelist
+// @param old = The head being replaced
+// @param index = The index of the new top block (0 for an empty stack)
+// @return Returns: uint64_t, the new head
+uint64_t stackhead(List *list, uint64_t old, uint64_t index)
+{
+    return (((old >> list->stackBits) + 1) << list->stackBits) | index;
+}
 
-            // Free the block
-            mmfree(nextBuddy, sizeof(Buddy));
+// Pushes a free block on a level's lock-free stack
+// The first word of the block holds the index of the block under it
+// @param *list = The freelist
+// @param *mem = The block
+// @param exponent = The block size exponent
+void stackpush(List *list, void *mem, int exponent)
+{
+    // Grabbing the stack and what the block will be known by on it
+    uint64_t *stack = &list->levels[exponent].stack;
+    uint64_t index = stackindex(list, mem);
 
-            // Save that block into the head of the list
-            buddies[exponent] = nextnextBuddy;
-        }
-    }
-    else
+    // Link the block on top of whatever is there, again if the head changed meanwhile
+    uint64_t old = __atomic_load_n(stack, __ATOMIC_RELAXED);
+    do
     {
-        // Find the node before the pair to remove
-        Buddy *startOfList = buddies[exponent];
-
-        // Loop through the whole list of buddies
-        while (1)
-        {
-            // Get the next buddy to check if the pair is there
-            Buddy *nextBuddy = startOfList->nextBuddy;
+        __atomic_store_n((uint64_t *)mem, old & list->stackMask, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(stack, &old, stackhead(list, old, index), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-            // Does the next node == the node pair we want to delete?
-            if (nextBuddy->currentLocation == targetAddress)
-            {
+// Pops the top block off a level's lock-free stack
+// @param *list = The freelist
+// @param exponent = The block size exponent
+// @return Returns: void *, the block, or NULL if the stack is empty
+void *stackpop(List *list, int exponent)
+{
+    // Grabbing the stack
+    uint64_t *stack = &list->levels[exponent].stack;
 
-                // fprintf(stdout, "Found base buddy! Location: %p\n", nextBuddy->currentLocation);
+    uint64_t old = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    while (old & list->stackMask)
+    {
+        void *block = stackblock(list, old & list->stackMask);
 
-                // It is what we want to delete
-                // Get the nextnextBuddy to delete (right node of buddy)
-                Buddy *nextnextBuddy = nextBuddy->nextBuddy;
+        // Another thread may have popped the block (and written over it) already,
+        // the tag in the head makes the swap fail if so
+        uint64_t next = __atomic_load_n((uint64_t *)block, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(stack, &old, stackhead(list, old, next), 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            return block;
+        }
+    }
 
-                // fprintf(stdout, "Location of the right buddy: %p\n", nextnextBuddy->currentLocation);
+    return NULL;
+}
 
-                // Is the right buddy have something after
-                if (issingle(nextnextBuddy))
-                {
-                    // There no node after
-                    // fprintf(stdout, "Nothing pointing after the right buddy!\n");
+// Takes every block off a level's lock-free stack at once
+// @param *list = The freelist
+// @param exponent = The block size exponent
+// @return Returns: uint64_t, the index of the top block (0 if there was none), the rest follow through their first words
+uint64_t stackdrain(List *list, int exponent)
+{
+    // Grabbing the stack
+    uint64_t *stack = &list->levels[exponent].stack;
 
-                    // Adjust pointers
-                    startOfList->nextBuddy = NULL;
+    uint64_t old = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(stack, &old, stackhead(list, old, 0), 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        // Try again with the new head
+    }
 
-                    // fprintf(stdout, "The buddy previous to location of left and right buddy is: %p\n", startOfList->currentLocation);
+    return old & list->stackMask;
+}
 
-                    // Free left and right nodes
-                    mmfree(nextBuddy, sizeof(Buddy));
-                    mmfree(nextnextBuddy, sizeof(Buddy));
-                }
-                else
-                {
-                    // There is a node after
-                    // fprintf(stdout, "Something pointing after the right buddy!\n");
+// Unlinks a free block from anywhere in its level's list
+// The level's lock has to be held
+// @param *list = The freelist
+// @param *currentBuddy = The block to unlink
+// @param exponent = The block size exponent
+void removenode(List *list, Buddy *currentBuddy, int exponent)
+{
+    // An address ordered level only has to clear the block's bit
+    if (list->freemaps[exponent])
+    {
+        obmclr(list->freemaps[exponent], list->baseAddress, currentBuddy, exponent);
 
-                    // Adjust pointers
-                    startOfList->nextBuddy = nextnextBuddy->nextBuddy;
+        if (!obmany(list->freemaps[exponent]) && list->levels[exponent].lazy == NULL)
+        {
+            __atomic_fetch_and(&list->nonEmpty, ~((uint64_t)1 << exponent), __ATOMIC_RELAXED);
+        }
+        return;
+    }
 
-                    // fprintf(stdout, "The buddy previous to location of left and right buddy is: %p\n", startOfList->currentLocation);
+    // Relinking the neighbors around the block
+    // Ex: [prev]-->[currentBuddy]-->[next] becomes [prev]-->[next]
+    if (currentBuddy->prevBuddy)
+    {
+        currentBuddy->prevBuddy->nextBuddy = currentBuddy->nextBuddy;
+    }
+    else
+    {
+        // The block was the head of the list
+        list->levels[exponent].head = currentBuddy->nextBuddy;
+    }
 
-                    // Free left and right nodes
-                    mmfree(nextBuddy, sizeof(Buddy));
-                    mmfree(nextnextBuddy, sizeof(Buddy));
-                }
+    if (currentBuddy->nextBuddy)
+    {
+        currentBuddy->nextBuddy->prevBuddy = currentBuddy->prevBuddy;
+    }
 
-                // No more looping
-                break;
-            }
-            else
-            {
-                // Iterate the list
-                startOfList = nextBuddy;
-            }
-        }
+    // Was it the last block on the level?
+    if (list->levels[exponent].head == NULL && list->levels[exponent].lazy == NULL)
+    {
+        __atomic_fetch_and(&list->nonEmpty, ~((uint64_t)1 << exponent), __ATOMIC_RELAXED);
     }
 
     // It is removed!
     return;
 }
 
-// Helper method that does the dirty work for allocation
-// @param *currentBuddy = The current buddy in pointer form
-// @param **buddies = Array of pointers to the buddies
-// @param bitmap = A buddy bit map
-// @param *base = The base of the memory address in the pool
-// @param exponent = Exponent of the block size
-// @param singleNodeFlag = Flag to indicate if the list is a single node
-// @return Returns: void *, Where the allocated block starts
-void *allocation(Buddy *currentBuddy, Buddy **buddies, BBM bitmap, void *base, int exponent, int singleNodeFlag)
+// Helper method that does the dirty work for unallocation
+// Writes a node into the freed block and pushes it on the front of the level
+// (or sets its bit, if the level is address ordered)
+// The level's lock has to be held
+// @param *list = The freelist
+// @param *mem = The offset of where the allocation occured
+// @param exponent = Exponent of the block that needs to be unallocated
+void unallocation(List *list, void *mem, int exponent)
 {
+    // An address ordered level keeps no links, the bit finds it again
+    if (list->freemaps[exponent])
+    {
+        obmset(list->freemaps[exponent], list->baseAddress, mem, exponent);
+        __atomic_fetch_or(&list->nonEmpty, (uint64_t)1 << exponent, __ATOMIC_RELAXED);
+        return;
+    }
 
-    // Address that is at the start of the to be allocated block
-    void *location;
+    // The node lives at the start of the freed block
+    Buddy *resurrectedBuddy = (Buddy *)mem;
 
-    // Condition where there is a single node in the list
-    if (singleNodeFlag)
+    // Get the head of the list for the buddy level
+    Buddy *headOfList = list->levels[exponent].head;
+
+    // Ex: [resurrectedBuddy]-->[headOfList]-->....
+    resurrectedBuddy->prevBuddy = NULL;
+    resurrectedBuddy->nextBuddy = headOfList;
+    if (headOfList)
     {
-        // Grab the address of the block the buddy is pointing too (so it can be returned)
-        location = currentBuddy->currentLocation;
+        headOfList->prevBuddy = resurrectedBuddy;
+    }
 
-        // Update the current block (to point at nothing)
-        currentBuddy->currentLocation = NULL;
+    // New head of the list
+    list->levels[exponent].head = resurrectedBuddy;
+    __atomic_fetch_or(&list->nonEmpty, (uint64_t)1 << exponent, __ATOMIC_RELAXED);
+}
 
-        // Update the bitmap to mark the block
-        // Using the base of the bitmap and the offset
-        bbmset(bitmap, base, location, exponent);
-    }
-    else
-    {
-        // There are at least 2 blocks in the list
+// Puts a block on its level's lazy list without merging it
+// The level's lock has to be held
+// @param *list = The freelist
+// @param *mem = The block
+// @param exponent = The block size exponent
+void pushlazy(List *list, void *mem, int exponent)
+{
+    Level *level = &list->levels[exponent];
 
-        // Grab the address of the block the buddy is pointing too (so it can be returned)
-        location = currentBuddy->currentLocation;
+    // Its pair bit is left alone, as far as merging goes it is still allocated
+    ((Buddy *)mem)->nextBuddy = level->lazy;
+    level->lazy = (Buddy *)mem;
+    level->lazyCount++;
 
-        // Get the next buddy so it will cover in the spot of the previous buddy
-        Buddy *nextBuddy = currentBuddy->nextBuddy;
+    __atomic_fetch_add(&list->lazyBlocks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&list->nonEmpty, (uint64_t)1 << exponent, __ATOMIC_RELAXED);
+}
 
-        // Free the block
-        mmfree(currentBuddy, sizeof(Buddy));
+// Takes blocks off a level's lazy list
+// The level's lock has to be held
+// @param *list = The freelist
+// @param exponent = The block size exponent
+// @param n = How many blocks to take (the most recently freed ones)
+// @return Returns: Buddy *, the blocks linked through nextBuddy (NULL if there were none)
+Buddy *poplazy(List *list, int exponent, size_t n)
+{
+    Level *level = &list->levels[exponent];
 
-        // Save that block into the head of the list
-        buddies[exponent] = nextBuddy;
+    // Cutting the first n off
+    Buddy *blocks = level->lazy;
+    Buddy **link = &level->lazy;
+    size_t taken = 0;
+    while (*link && taken < n)
+    {
+        link = &(*link)->nextBuddy;
+        taken++;
+    }
+    level->lazy = *link;
+    *link = NULL;
+    level->lazyCount -= taken;
 
-        // Using the base of the bitmap and the offset
-        bbmset(bitmap, base, location, exponent);
+    __atomic_fetch_sub(&list->lazyBlocks, taken, __ATOMIC_RELAXED);
+
+    // Was it the last block on the level?
+    if (level->lazy == NULL && (list->freemaps[exponent] ? !obmany(list->freemaps[exponent]) : level->head == NULL))
+    {
+        __atomic_fetch_and(&list->nonEmpty, ~((uint64_t)1 << exponent), __ATOMIC_RELAXED);
     }
 
-    // Return the location of the allocated block
-    return location;
+    return taken ? blocks : NULL;
 }
 
-// Splits a block recursively down to the requested exponent
-// @param *currentBuddy = The current buddy
-// @param **buddies = An array of pointers to all of the buddies
-// @param bitmap = A buddy bitmap
-// @param *base = The base address of the memory pool
-// @param lower = Lower bound exponent
-// @param requestedExponent = Requested size allocation in exponent form
-// @param exponent = Current block size exponent
-// @return Returns: Buddy *, A pointer to the location of the currentBuddy (after all the splits and stuff)
-Buddy *splitblock(Buddy *currentBuddy, Buddy **buddies, BBM bitmap, void *base, int lower, int requestedExponent, int exponent)
+// Flips the pair bit of a block that is entering or leaving its level's list
+// The level's lock has to be held
+// @param *list = The freelist
+// @param *mem = The block
+// @param exponent = The block size exponent
+// @return Returns: int, 1 if exactly one buddy of the pair is now free, 0 if both or neither
+int togglepair(List *list, void *mem, int exponent)
 {
-
-    // BASE CASE: Have we finally reached what was requested
-    if (requestedExponent == exponent)
+    // The highest blocks are never merged, so they do not keep a pair bit
+    if (list->pairmaps[exponent] == NULL)
     {
-        // This means the splitting is complete and the lists and bitmaps should reflect that
-        return buddies[requestedExponent];
+        return 1;
     }
-    else
+
+    return bbminv(list->pairmaps[exponent], list->baseAddress, mem, exponent);
+}
+
+// Gets the first free block of a level, the lowest one if the level is address ordered
+// The level's lock has to be held
+// @param *list = The freelist
+// @param exponent = The level
+// @return Returns: Buddy *, the block (still on the level), or NULL if the level is empty
+Buddy *firstnode(List *list, int exponent)
+{
+    if (list->freemaps[exponent])
     {
-        // Split the block
+        return (Buddy *)obmfirst(list->freemaps[exponent], list->baseAddress, list->baseAddress, exponent);
+    }
 
-        // Get the list at the current level (AKA the one below the currentBuddy)
-        Buddy *currentBuddyLevel = buddies[exponent - 1];
+    return list->levels[exponent].head;
+}
 
-        // Grab the bitmap at that level
-        BBM currentBitMap = currentBuddyLevel->bitmap;
+// Helper method that does the dirty work for allocation
+// Pops the head of the level's list and marks it on the bitmap
+// @param *list = The freelist
+// @param exponent = Exponent of the block size
+// @return Returns: void *, Where the allocated block starts, or NULL if another thread emptied the level first
+void *allocation(List *list, int exponent)
+{
+    lockorder(list, exponent);
 
-        // Do a typical allocation, but there will be more work
-        // Getting the starting address from the bigger block
-        // 1st new block: startAddr
-        // 2nd new block: secondStartAddr
-        void *startAddr = allocation(currentBuddy, buddies, bitmap, base, exponent, issingle(currentBuddy));
+    // A block that was freed lazily goes first, its pair bit already says it is allocated
+    Buddy *location = poplazy(list, exponent, 1);
 
-        // Finding the middle address between the startAddr and the ending address
-        void *secondStartAddr = ((char *)(startAddr) + (e2size(exponent) / 2));
+    if (location == NULL && (location = firstnode(list, exponent)))
+    {
+        // Take it off the list
+        removenode(list, location, exponent);
 
-        // Build the list at the lower level
-        // New list node
-        // May seem strange that it is "secondNode", but it is the one that must be added first
-        Buddy *secondNode = mmalloc(sizeof(Buddy));
+        // The block left the list, update the bitmap to reflect it
+        togglepair(list, location, exponent);
+    }
 
-        // Setting the address to the secondStartAddr
-        secondNode->currentLocation = secondStartAddr;
+    unlockorder(list, exponent);
 
-        // ? Setting to what it is looking at NULL.. for now
-        // * This logic might be wrong
-        // * Im unsure about this becuase if you are splitting does
-        // that not imply the level has no nodes? (Might even throw a segfault)
-        secondNode->nextBuddy = currentBuddyLevel->nextBuddy;
+    // Return the location of the allocated block
+    return (void *)location;
+}
 
-        // Saving bitmap into the buddy
-        secondNode->bitmap = currentBitMap;
+// Takes up to n blocks off a level as they are, without splitting anything
+// @param *list = The freelist
+// @param exponent = The level
+// @param n = How many blocks are wanted
+// @param **blocks = Where the blocks are stored (room for n)
+// @return Returns: size_t, how many blocks were taken (0 if the level is empty)
+size_t allocationn(List *list, int exponent, size_t n, void **blocks)
+{
+    size_t count = 0;
 
-        // Add to the start of the list
-        buddies[exponent - 1] = secondNode;
+    if (!levelhasblock(list, exponent))
+    {
+        return 0;
+    }
 
-        // Now repeat the process for the 'first' node and add it to the list
-        Buddy *firstNode = mmalloc(sizeof(Buddy));
+    // Lock-free levels are popped one block at a time
+    if (list->mode == FREELIST_LOCKFREE)
+    {
+        while (count < n && (blocks[count] = stackpop(list, exponent)))
+        {
+            count++;
+        }
+        return count;
+    }
 
-        // Using the startAddr this time
-        firstNode->currentLocation = startAddr;
+    // Everything else is taken under one lock
+    lockorder(list, exponent);
+    while (count < n)
+    {
+        Buddy *location = poplazy(list, exponent, 1);
 
-        // firstNode --> Next --> secondNode
-        // Ehh? Makes sense, huh?
-        firstNode->nextBuddy = secondNode;
+        if (location == NULL && (location = firstnode(list, exponent)))
+        {
+            removenode(list, location, exponent);
+            togglepair(list, location, exponent);
+        }
 
-        // Saving bitmap into the buddy
-        firstNode->bitmap = currentBitMap;
+        if (location == NULL)
+        {
+            break;
+        }
+        blocks[count++] = location;
+    }
+    unlockorder(list, exponent);
 
-        // Add to the start of the list
-        buddies[exponent - 1] = firstNode;
+    return count;
+}
 
-        // I believe the splitting is done now
-        // Recursion time now! Yay! :')
+// Splits a block down to the requested exponent, giving the right
+// half back to the list at every level on the way down
+// (only one level is locked at a time, the left half is ours the whole way)
+// @param *list = The freelist
+// @param *block = The block being split (already off its list)
+// @param requestedExponent = Requested size allocation in exponent form
+// @param exponent = Current block size exponent
+void splitblock(List *list, void *block, int requestedExponent, int exponent)
+{
 
-        // Set the current buddy to the firstNode
-        currentBuddy = firstNode;
+    // Keep halving until we have finally reached what was requested
+    while (exponent > requestedExponent)
+    {
+        // Drop a level
+        exponent--;
+
+        // Finding the middle address between the start and the ending address
+        void *secondHalf = (char *)block + e2size(exponent);
 
-        // Same call but with the exponent dropping
-        return splitblock(currentBuddy, buddies, currentBitMap, base, lower, requestedExponent, exponent - 1);
+        // Lock-free levels do not keep pair bits, it just goes on the stack
+        if (list->mode == FREELIST_LOCKFREE)
+        {
+            stackpush(list, secondHalf, exponent);
+            continue;
+        }
+
+        // The right half is free, and is the only one of the pair that is
+        lockorder(list, exponent);
+        togglepair(list, secondHalf, exponent);
+        unallocation(list, secondHalf, exponent);
+        unlockorder(list, exponent);
     }
 }
 
@@ -562,497 +830,723 @@ Buddy *splitblock(Buddy *currentBuddy, Buddy **buddies, BBM bitmap, void *base,
 // because that implies there are no valid free blocks that will satify the allocation
 // @param exponent = Current exponent
 // @param upper = Upper exponent bound
-void checkexponent(int exponent, int upper)
+// @return Returns: int, 1 if the exponent is still ok, 0 if there is no block to be had
+int checkexponent(int exponent, int upper)
 {
-    if (exponent > upper)
-    {
-        // Cannot go higher, there is not a block that will satisfy this allocation
-
-        // Output error message
-        fprintf(stderr, "Cannot allocate memory: No free block in system that is of adequate size!\n");
-        exit(1);
-    }
-    else
-    {
-        // Still ok
-        return;
-    }
+    // Cannot go higher, there is not a block that will satisfy this allocation
+    return exponent <= upper;
 }
 
-// Allocates a block of memory from the freelist
-// @param f = A freelist
-// @param *base = The base address of the pool (I believe)
+// Takes a block off the smallest level that can serve the request and splits it down
+// @param *list = The freelist
 // @param e = Requested exponent
-// @param l = Lower exponent bound
-// @return Returns: void *, an address of where the memory was allocated
-void *freelistalloc(FreeList f, void *base, int e, int l)
+// @param upper = Upper exponent bound
+// @return Returns: void *, the block, or NULL if no level can serve it
+void *listblock(List *list, int e, int upper)
 {
+    void *block = NULL;
+    int exponent = e;
 
-    // Aliasing
-    int exponent = e, lower = l;
-
-    // Used for later case when you need a base exponent
-    int requestedExponent = e;
+    // Levels at or above the requested one that have a free block
+    uint64_t usable;
 
-    // Validating the freelist
-    if (!f)
+    // Another thread can empty a level between reading the summary and locking it,
+    // so keep going until a block is had or the summary says there is none
+    while (block == NULL && (usable = __atomic_load_n(&list->nonEmpty, __ATOMIC_RELAXED) & (~(uint64_t)0 << e)))
     {
-        // Outputting error message
-        fprintf(stderr, "Freelist is not valid!");
-        exit(1);
-    }
+        // The smallest of them is the lowest set bit
+        exponent = __builtin_ctzll(usable);
 
-    // Grab the list representation of the freelist
-    List *list = (List *)f;
+        // Make sure things are not getting out of scope
+        if (!checkexponent(exponent, upper))
+        {
+            return NULL;
+        }
 
-    // Validating the base pool address
-    if (!base)
+        // Take the block off its list
+        block = allocation(list, exponent);
+    }
+
+    // No level can serve it
+    if (block == NULL)
     {
-        // Outputting error messsage
-        fprintf(stderr, "Base pool address is not valid!");
-        exit(1);
+        return NULL;
     }
 
-    // Allocation begins
-    // First, check to see if there is a free block in the correlate list to e
+    // Split the block (does nothing if the block is already the right size)
+    splitblock(list, block, e, exponent);
 
-    // Grab the lists (array of pointers)
-    Buddy **buddies = list->buddies;
+    return block;
+}
 
-    // Grab the buddy at the exponent requested level
-    Buddy *currentBuddy = buddies[exponent];
+// Builds up the freelist until it cannot
+// Every level is constant time, the pair bit says whether the buddy is
+// free and the buddy is unlinked through its own node
+// Only the level being merged at is locked, the merged block is ours until
+// it is put on a list (or back in the wilderness)
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param *mem = The location of where the buddy was freed
+// @param exponent = Block size exponent
+// @param upper = Upper exponent bounds
+void buildup(List *list, void *base, void *mem, int exponent, int upper)
+{
+    lockorder(list, exponent);
 
-    // Grab upper exponent
-    const int upper = list->managementData[1];
+    // Climb while the freed block's buddy is free as well
+    while (exponent < upper && !togglepair(list, mem, exponent))
+    {
+        // A pair of buddies are found, which means they will be built up
+        // Where the buddy is ('right' if mem is the left one, 'left' otherwise)
+        void *buddy = baddrinv(base, mem, exponent);
 
-    // Memory return address
-    void *startOfFreeMem;
+        // Remove the buddy from the lower level so they can be tranferred to a higher level
+        // (the pair bit was flipped once for each buddy leaving, so it stays clear)
+        removenode(list, (Buddy *)buddy, exponent);
+
+        // The base address of the left and right buddy
+        // Ex: ...-->[Left]-->[Right]-->...
+        // ----------^Base^----------------------------
+        mem = baddrclr(base, mem, exponent);
+
+        // Go up a level
+        unlockorder(list, exponent);
+        exponent++;
+        lockorder(list, exponent);
+    }
 
-    // Check if there is a valid block
-    if (currentBuddy->currentLocation != NULL)
+    // A block right below the wilderness goes back into it instead of on a list
+    // (checked again under the lock, the wilderness may have moved)
+    if ((char *)mem + e2size(exponent) == peekwilderness(list))
     {
-        // There is a free block!
-        // Processing the block
+        lockwilderness(list);
 
-        // Grabbing bitmap from the respective level
-        BBM bitmap = currentBuddy->bitmap;
+        if ((char *)mem + e2size(exponent) == list->wilderness)
+        {
+            // It is not free on a list after all, so its pair bit goes back
+            if (exponent < upper)
+            {
+                togglepair(list, mem, exponent);
+            }
+
+            setwilderness(list, (char *)mem);
+            unlockwilderness(list);
+            unlockorder(list, exponent);
+            return;
+        }
 
-        // Run a allocation with checking the case if the list is single noded or not
-        startOfFreeMem = allocation(currentBuddy, buddies, bitmap, base, exponent, issingle(currentBuddy));
+        unlockwilderness(list);
     }
-    else
+
+    // Building complete, the block goes on the list where it stopped
+    unallocation(list, mem, exponent);
+    unlockorder(list, exponent);
+}
+
+// Merges every block that was freed lazily, bottom level first, so blocks
+// merged on one level can go on to merge with the lazy blocks of the next
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param upper = Upper exponent bound
+void mergelazy(List *list, void *base, int upper)
+{
+    for (int exponent = list->managementData[0]; exponent < upper; exponent++)
     {
-        // Need to go to a higher level and split
-        // Go up level (Block Size)
-        exponent++;
+        // Taking the level's lazy blocks all at once, they are ours until they are freed for real
+        lockorder(list, exponent);
+        Buddy *blocks = poplazy(list, exponent, (size_t)-1);
+        unlockorder(list, exponent);
+
+        while (blocks)
+        {
+            Buddy *next = blocks->nextBuddy;
+            buildup(list, base, blocks, exponent, upper);
+            blocks = next;
+        }
+    }
+}
 
-        // Flag for when a valid block is found
-        int found = 0;
+// Frees a range of the wilderness onto the lists as the biggest aligned blocks that fit
+// (the range has already been taken out of the wilderness, so no lock is needed for it)
+// Ex: [16, 64) --> free 16 at 16, free 32 at 32
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param *from = Start of the range (a multiple of 2^l from base)
+// @param *to = End of the range
+// @param upper = Upper exponent bound
+void releaserange(List *list, void *base, char *from, char *to, int upper)
+{
+    while (from < to)
+    {
+        // The lowest set bit of the offset is the biggest block that can start there
+        size_t offset = from - (char *)base;
+        int exponent = offset ? __builtin_ctzll(offset) : upper;
 
-        // This while loop is going to keep climbing levels until it finds a free block that can be split
-        while (!found)
+        // But it can not be above the highest level or run past the range
+        if (exponent > upper)
         {
+            exponent = upper;
+        }
+        while (from + e2size(exponent) > to)
+        {
+            exponent--;
+        }
 
-            // Make sure things are not getting out of scope
-            checkexponent(exponent, upper);
+        // Freeing it like any other block (merging with free buddies below it,
+        // or later on when the freelist is lock-free)
+        if (list->mode == FREELIST_LOCKFREE)
+        {
+            stackpush(list, from, exponent);
+        }
+        else
+        {
+            buildup(list, base, from, exponent, upper);
+        }
 
-            // Looking for the block size above
-            currentBuddy = buddies[exponent];
+        from += e2size(exponent);
+    }
+}
 
-            // Is there something free?
-            if (currentBuddy->currentLocation != NULL)
-            {
-                // Free block has been located
-                // Time to split the block
+// Hands out a block straight off the wilderness, bumping it past the block
+// The wilderness is first aligned up to the block size, and the blocks that
+// alignment skips over are freed onto the lists
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param upper = Upper exponent bound
+// @return Returns: void *, the block, or NULL if the wilderness is too small
+void *bumpblock(List *list, void *base, int e, int upper)
+{
+    lockwilderness(list);
 
-                // Free block has been found
-                found = 1;
-            }
-            else
-            {
-                // Go to the next level
-                exponent++;
-            }
-        }
+    // Where the block would go, the wilderness rounded up to the block size
+    size_t blockSize = e2size(e);
+    char *block = (char *)base + roundup(list->wilderness - (char *)base, blockSize);
 
-        // Grabbing bitmap from the respective level
-        BBM bitmap = currentBuddy->bitmap;
+    // The part of the wilderness being skipped over
+    char *gap = list->wilderness;
 
-        // Split the blocks recursively
-        currentBuddy = splitblock(currentBuddy, buddies, bitmap, base, lower, requestedExponent, exponent);
+    // Is there room for it?
+    if (block + blockSize > list->end)
+    {
+        // No, so the rest of the wilderness is freed onto the lists where it
+        // can merge with the free blocks next to it
+        char *end = list->end;
+        setwilderness(list, end);
+        unlockwilderness(list);
 
-        // Get bitmap after the splitting
-        bitmap = currentBuddy->bitmap;
+        // (merging takes level locks, so the wilderness lock has to be let go first)
+        releaserange(list, base, gap, end, upper);
 
-        // Run that allocation
-        startOfFreeMem = allocation(currentBuddy, buddies, bitmap, base, e, issingle(currentBuddy));
+        // Merging can hand blocks right back to the wilderness, try again if it grew
+        return peekwilderness(list) < gap ? bumpblock(list, base, e, upper) : NULL;
     }
 
-    // Block has been allocated
-    return startOfFreeMem;
+    // Bump the wilderness past the block
+    setwilderness(list, block + blockSize);
+    unlockwilderness(list);
+
+    // Free the gap it skipped over
+    releaserange(list, base, gap, block, upper);
+
+    return block;
 }
 
-// Helper method that gives you an idea what buddy of the two you are looking a
-// This is achieved using modular division as the block to the 'right' will always
-// return a value that is non zero when you apply % sizeofLargerBlock as opposed
-// to the block on the left
-// @param *currentBuddy = The current buddy being checked
-// @param *base = The base address of the memory pool
-// @param sizeOfLargerBlock = The size of a block that is a level highert
-// @return Returns: int, 1 for left, 0 for right
-int leftorrightbuddy(Buddy *currentBuddy, void *base, int sizeOfLargerBlock)
+// Commits more of a growable pool's reserved range, whole highest level
+// blocks at a time, so the wilderness can hold a block of the requested size
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param upper = Upper exponent bound
+// @return Returns: int, 1 if the pool grew, 0 if it is at its limit (or not growable)
+int growpool(List *list, void *base, int e, int upper)
 {
-    // Getting location of the currentBuddy
-    void *currentBuddyLocation = currentBuddy->currentLocation;
+    lockwilderness(list);
 
-    // Calculating the offset from the base by using a pointer diff
-    ptrdiff_t offset = (char *)base - (char *)currentBuddyLocation;
+    // Where the block would go once the wilderness is aligned for it
+    size_t blockSize = e2size(e);
+    size_t needed = roundup(peekwilderness(list) - (char *)base, blockSize) + blockSize;
 
-    // Is it left or right
-    if (offset % sizeOfLargerBlock == 0)
+    // Another thread already grew it enough
+    if ((char *)base + needed <= list->end)
     {
-        // Left block return value
-        // fprintf(stdout, "This is the left buddy: %p\n", currentBuddyLocation);
+        unlockwilderness(list);
         return 1;
     }
-    else
+
+    // Growing by whole highest level blocks (and whole pages)
+    char *newEnd = (char *)base + roundup(roundup(needed, e2size(upper)), pagesize());
+
+    // But never past what was reserved
+    if (newEnd > list->limit)
+    {
+        newEnd = list->limit;
+    }
+
+    // Can not fit it even at the limit, or the system will not commit it
+    if ((char *)base + needed > newEnd || !mmcommit(list->end, newEnd - list->end))
     {
-        // Right block return value
-        // fprintf(stdout, "This is the right buddy: %p\n", currentBuddyLocation);
+        unlockwilderness(list);
         return 0;
     }
+
+    // The new part of the pool is wilderness
+    __atomic_store_n(&list->end, newEnd, __ATOMIC_RELEASE);
+    unlockwilderness(list);
+    return 1;
 }
 
-// Loops through a singly linked list to find an address
-// @param *headOfList = A buddy that starts at the front of the list
-// @param *address = Address that is being looked for
-// @return Returns: int, 1 for found, 0 for no
-int lookforaddress(Buddy *headOfList, void *address)
+// Refills an empty level in one go: a block of the level's refill order is
+// taken (off the lists, or the wilderness) and cut into blocks of the level's size
+// The first is handed out and the rest go on the lazy list lowest address first,
+// they were never merged, so their pair bits say they are all allocated
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param upper = Upper exponent bound
+// @return Returns: void *, the block, or NULL if there is no block of the refill order to be had
+void *refilllevel(List *list, void *base, int e, int upper)
 {
+    const int exponent = list->levels[e].refillOrder;
 
-    // Current buddy holder
-    Buddy *currentBuddy = headOfList;
+    // Memory is tight if no block that big is around, so it is left to splitting one at a time
+    void *block = listblock(list, exponent, upper);
+    if (block == NULL)
+    {
+        block = bumpblock(list, base, exponent, upper);
+    }
+    if (block == NULL)
+    {
+        return NULL;
+    }
 
-    // Loops through all buddies in the list
-    while (currentBuddy != NULL)
+    // Cutting it up, the highest address goes on first so the lowest ends up on top
+    lockorder(list, e);
+    for (char *piece = (char *)block + e2size(exponent) - e2size(e); piece > (char *)block; piece -= e2size(e))
     {
-        // Is the address in the list?
-        if (currentBuddy->currentLocation == address)
-        {
-            // Found it.
-            return 1;
-        }
-        // Increment currentBuddy pointer
-        currentBuddy = currentBuddy->nextBuddy;
+        pushlazy(list, piece, e);
     }
+    unlockorder(list, e);
 
-    // Did not find it :(
-    return 0;
+    return block;
 }
 
-// Checks if the list is empty
-// @param *currentBuddy = A pointer to the buddy that's list is being checked
-// @return Returns: int, 1 for is empty and 0 for no
-int isemptylist(Buddy *currentBuddy)
+// Hands out a block straight off the wilderness of a lock-free freelist
+// Same as bumpblock(), but the wilderness is moved with compare and swap
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param upper = Upper exponent bound
+// @return Returns: void *, the block, or NULL if the wilderness is too small
+void *stackbump(List *list, void *base, int e, int upper)
 {
-    // Is list empty?
-    if (currentBuddy->currentLocation == NULL)
+    size_t blockSize = e2size(e);
+
+    // The part of the wilderness being skipped over starts where the wilderness does
+    char *gap = peekwilderness(list);
+
+    for (;;)
     {
-        // Return it is empty value
-        return 1;
+        // Where the block would go, the wilderness rounded up to the block size
+        char *block = (char *)base + roundup(gap - (char *)base, blockSize);
+        char *end = __atomic_load_n(&list->end, __ATOMIC_ACQUIRE);
+        int fits = block + blockSize <= end;
+
+        // Claim the block, or everything that is left if it does not fit
+        // (gap is updated to the new wilderness when another thread got there first)
+        if (__atomic_compare_exchange_n(&list->wilderness, &gap, fits ? block + blockSize : end, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            // What was skipped over goes on the stacks
+            releaserange(list, base, gap, fits ? block : end, upper);
+            return fits ? block : NULL;
+        }
     }
-    else
-    {
-        // List is not empty
+}
 
-        // Not empty return value
-        return 0;
+// Gives a block back to the wilderness if it is right below it, or pushes it on its stack
+// @param *list = The freelist
+// @param *mem = The block
+// @param exponent = The block size exponent
+void stackgiveback(List *list, void *mem, int exponent)
+{
+    char *wilderness = (char *)mem + e2size(exponent);
+
+    if (!__atomic_compare_exchange_n(&list->wilderness, &wilderness, (char *)mem, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        stackpush(list, mem, exponent);
     }
 }
 
-// Helper method that does the dirty work for unallocation
-// @param ** buddies = Array of pointers to the buddies
-// @param bitmap = A buddy bitmap
-// @param *base = The base of the memory address in the pool
-// @param *mem = The offset of where the allocation occured
-// @param exponent = Exponent of the block that needs to be unallocated
-// @param lower = Lower Exponent Bounds
-// @return Returns: Buddy *, a pointer to the resurrected buddy!
-Buddy *unallocation(Buddy **buddies, BBM bitmap, void *base, void *mem, int exponent, int lower, int emptyListFlag)
+// Takes a block for a lock-free freelist, from the requested level, the
+// wilderness, or a bigger level split down (in that order)
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param upper = Upper exponent bound
+// @return Returns: void *, the block, or NULL if none of them had one
+void *stacktake(List *list, void *base, int e, int upper)
 {
-    // Get the head of the list for the buddy level
-    Buddy *currentBuddyLevel = buddies[exponent];
+    void *block = stackpop(list, e);
 
-    // Saving buddy location
-    Buddy *freedBuddy;
-
-    // Add back into the freelist, but must account if the list is empty or not
-    if (emptyListFlag)
+    if (block == NULL)
     {
-        // List is empty
-        // fprintf(stdout, "List is empty!\n");
-        // Simple, just modify the front of the list
+        block = stackbump(list, base, e, upper);
+    }
 
-        // Setting the address to the location of where the allocation occured
-        currentBuddyLevel->currentLocation = mem;
+    for (int exponent = e + 1; block == NULL && exponent <= upper; exponent++)
+    {
+        block = stackpop(list, exponent);
 
-        // Saving the location into freedBuddy
-        freedBuddy = currentBuddyLevel;
+        if (block)
+        {
+            splitblock(list, block, e, exponent);
+        }
     }
-    else
+
+    return block;
+}
+
+// Merges every free buddy pair of a lock-free freelist, bottom level first
+// Each level's stack is taken whole, the pair bits (always clear otherwise)
+// are flipped once per block, so a pair that ends up clear had both buddies
+// on the stack and is carried up as one block, the rest go back on the stack
+// Only one thread merges at a time (the pair bits are not changed atomically),
+// this is the one place a lock-free freelist can make a thread wait: the others
+// keep taking blocks as the merging thread gives them back level by level, and
+// only wait when there is nothing for them until it is done
+// (a pass costs about 25ns per free block, a 1 MiB pool freed as 65536 blocks
+// of 16 bytes takes 1.5ms to merge back into one, and it only happens once the pool runs dry)
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Exponent the caller is after
+// @param upper = Upper exponent bound
+// @return Returns: void *, a block of 2^e the caller took while someone else was merging, or NULL
+void *stackcompact(List *list, void *base, int e, int upper)
+{
+    const int lower = list->managementData[0];
+
+    // Someone else is merging, take a block as soon as one is given back (without sleeping on the lock)
+    unsigned int seen = __atomic_load_n(&list->compactions, __ATOMIC_ACQUIRE);
+    if (pthread_mutex_trylock(&list->compactLock) != 0)
     {
-        // List is not empty
-        // Not as simple, must figure out where to appropriately put in the list
+        while (__atomic_load_n(&list->compactions, __ATOMIC_ACQUIRE) == seen)
+        {
+            void *block = stacktake(list, base, e, upper);
+            if (block)
+            {
+                return block;
+            }
+            sched_yield();
+        }
+        return NULL;
+    }
 
-        // Rebuild a new node
-        Buddy *resurrectedBuddy = mmalloc(sizeof(Buddy));
+    // Blocks merged on the level below, linked through their first words
+    void *carry = NULL;
 
-        // Set the bitmap on the new node with the currentBuddyLevel's bitmap (they are on the same level)
-        resurrectedBuddy->bitmap = currentBuddyLevel->bitmap;
+    for (int exponent = lower; exponent <= upper; exponent++)
+    {
+        // Everything on the level plus what was carried up, linked by address from here on
+        void *blocks = carry;
+        carry = NULL;
 
-        // Setting the address to the location of where the allocation occured
-        resurrectedBuddy->currentLocation = mem;
+        uint64_t index = stackdrain(list, exponent);
+        while (index)
+        {
+            void *block = stackblock(list, index);
+            index = *(uint64_t *)block;
+            *(void **)block = blocks;
+            blocks = block;
+        }
 
-        // Find where to insert in list
+        // The highest blocks never merge
+        if (exponent == upper)
+        {
+            while (blocks)
+            {
+                void *block = blocks;
+                blocks = *(void **)block;
+                stackgiveback(list, block, exponent);
+            }
+            break;
+        }
 
-        // Check if allocation already exists
-        if (mem == currentBuddyLevel->currentLocation)
+        // Flip every block's pair bit
+        for (void *block = blocks; block; block = *(void **)block)
         {
-            // Outputting error message
-            fprintf(stderr, "SHOULD NOT BE POSSIBLE TO DO THIS OPERATION!\n");
-            exit(1);
+            bbminv(list->pairmaps[exponent], base, block, exponent);
         }
 
-        // Base Case: Is it at the start?
-        if (mem < currentBuddyLevel->currentLocation)
+        while (blocks)
         {
-            // At the start of the list
-            // Set the new buddy's next value to the currentBuddyLevel (Head of list)
-            resurrectedBuddy->nextBuddy = currentBuddyLevel;
+            void *block = blocks;
+            blocks = *(void **)block;
 
-            // Set new head of list to the resurrectedBuddy
-            buddies[exponent] = resurrectedBuddy;
+            if (bbmtst(list->pairmaps[exponent], base, block, exponent))
+            {
+                // Its buddy is not free, clear the bit again and put it back
+                bbminv(list->pairmaps[exponent], base, block, exponent);
+                stackgiveback(list, block, exponent);
+            }
+            else if (block == baddrclr(base, block, exponent))
+            {
+                // Both are free, the left one becomes the merged block
+                *(void **)block = carry;
+                carry = block;
+            }
 
-            // Saving the location into freedBuddy
-            freedBuddy = resurrectedBuddy;
+            // (a right buddy whose left one is here is part of the merged block)
         }
-        else
-        {
-            // Somewhere not at the start
+    }
 
-            // Aliasing for the current buddy
-            Buddy *currentBuddy = currentBuddyLevel;
+    // Let go of the lock before counting, anyone who saw it taken is waiting for the count
+    pthread_mutex_unlock(&list->compactLock);
+    __atomic_fetch_add(&list->compactions, 1, __ATOMIC_RELEASE);
 
-            // Grabbing the next value of the list
-            Buddy *nextBuddy = currentBuddy->nextBuddy;
+    return NULL;
+}
 
-            // If this is false that means we are at the end of the list
-            while (nextBuddy != NULL)
-            {
+// Takes a block off the lists or the wilderness, without merging anything or growing the pool
+// (so failing is cheap, the pool is left as it was)
+// @param *list = The freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param upper = Upper exponent bound
+// @return Returns: void *, the block (its order is not recorded), or NULL if none is free
+void *takeblock(List *list, void *base, int e, int upper)
+{
+    void *block = NULL;
 
-                // Check if allocation already exists
-                if (mem == currentBuddy->currentLocation)
-                {
-                    // Outputting error message
-                    fprintf(stderr, "SHOULD NOT BE POSSIBLE TO DO THIS OPERATION!\n");
-                    exit(1);
-                }
-
-                // Grabbing freed buddy location
-                void *ressurectedBuddyLocation = resurrectedBuddy->currentLocation;
-
-                // Grabbing next buddy location
-                void *nextBuddyLocation = nextBuddy->currentLocation;
-
-                // Comparing to see if nextBuddy is ahead of ressurectedBuddy
-                if (ressurectedBuddyLocation < nextBuddyLocation)
-                {
-                    // Behind, we have found the spot to nestle it in
-                    // Set the resurrectedBuddy's next to be the nextBuddy
-                    // Ex: [currentBuddy]-->[resurrectedBuddy]-->[nextBuddy]-->....
-                    resurrectedBuddy->nextBuddy = nextBuddy;
-
-                    // Set the currentBuddy's next to be the resurrectedBuddy
-                    currentBuddy->nextBuddy = resurrectedBuddy;
-
-                    // Saving the location into freedBuddy
-                    freedBuddy = resurrectedBuddy;
-
-                    // No more of this as the list is now properly aligned
-                    break;
-                }
-                else
-                {
-                    // Have not found spot yet, just continue down the list
-                    // Iterate both buddies
-                    currentBuddy = nextBuddy;
-                    nextBuddy = currentBuddy->nextBuddy;
-                }
-            }
+    if (list->mode == FREELIST_LOCKFREE)
+    {
+        // Pop it off a stack or the wilderness
+        return stacktake(list, base, e, upper);
+    }
 
-            // Checking if we reached the end of the list
-            if (nextBuddy == NULL)
-            {
-                // That means just add resurrectedBuddy to the end of the currentBuddy
-                // which in principle should be the last node
-                // Ex: ...->[currentBuddy]-->[resurrectedBuddy]-->
-                currentBuddy->nextBuddy = resurrectedBuddy;
+    // Nothing on the requested level, refill it with a whole block cut up if it
+    // refills, or try to serve it straight off the wilderness
+    // (an address ordered freelist splits a free block first, the wilderness is above all of them)
+    if (!levelhasblock(list, e) && list->levels[e].refillOrder)
+    {
+        block = refilllevel(list, base, e, upper);
+    }
+    if (block == NULL && !levelhasblock(list, e) && list->freemaps[e] == NULL)
+    {
+        block = bumpblock(list, base, e, upper);
+    }
 
-                // Setting the resurrectedBuddy's next buddy to be NULL because its at the tail
-                resurrectedBuddy->nextBuddy = NULL;
+    // Otherwise take a block off the lists
+    if (block == NULL)
+    {
+        block = listblock(list, e, upper);
+    }
+    if (block == NULL && list->freemaps[e])
+    {
+        block = bumpblock(list, base, e, upper);
+    }
 
-                // Saving the location into freedBuddy
-                freedBuddy = resurrectedBuddy;
-            }
-        }
+    return block;
+}
+
+// Allocates a block of memory from the freelist
+// @param f = A freelist
+// @param *base = The base address of the pool (I believe)
+// @param e = Requested exponent
+// @param l = Lower exponent bound
+// @return Returns: void *, an address of where the memory was allocated, or NULL if there is no free block big enough
+void *freelistalloc(FreeList f, void *base, int e, int l)
+{
+
+    // Validating the freelist
+    if (!f)
+    {
+        // Outputting error message
+        fprintf(stderr, "Freelist is not valid!");
+        exit(1);
+    }
+
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
+
+    // Validating the base pool address
+    if (!base)
+    {
+        // Outputting error messsage
+        fprintf(stderr, "Base pool address is not valid!");
+        exit(1);
     }
 
-    // fprintf(stdout, "Location of freed buddy: %p\n", freedBuddy->currentLocation);
+    // Grab upper exponent
+    const int upper = list->managementData[1];
 
-    // Returning the freed buddy
-    return freedBuddy;
-}
+    // Memory return address
+    void *startOfFreeMem = NULL;
 
-// Searches for the buddy in the freelist
-// @param directionFlag, 1 for right, 0 for left
-// @param *baseAddressOfBoth, the base address to be for the buddy pair treated as a pointer to the pointer (makes sense?)
-// @param *resurrectedBuddy, the buddy brought back from an unallocation
-// @param exponent, 2 base exponent of the block size
-// @return int, 1 for found and 0 for fail
-int findbuddy(int directionFlag, void **baseAddressOfBoth, Buddy *startOfList, Buddy *resurrectedBuddy, int exponent)
-{
+    // Pop it off a list or the wilderness
+    startOfFreeMem = takeblock(list, base, e, upper);
 
-    if (directionFlag)
+    if (startOfFreeMem == NULL && list->mode == FREELIST_LOCKFREE)
     {
-        // Check the right one
-        // Calculate the size to look for
-        void *rightBuddy = (char *)resurrectedBuddy->currentLocation + e2size(exponent);
-
-        // fprintf(stdout, "Looking for right buddy: %p\n", rightBuddy);
-
-        // Set the baseAddressOfBoth to the resurrectedBuddy
-        *baseAddressOfBoth = resurrectedBuddy->currentLocation;
-
-        // Look to see if the address is in the free blocks
-        return lookforaddress(startOfList, rightBuddy);
+        // Ran dry, merge what has been freed since last time and try again
+        startOfFreeMem = stackcompact(list, base, e, upper);
+        if (startOfFreeMem == NULL)
+        {
+            startOfFreeMem = stacktake(list, base, e, upper);
+        }
     }
-    else
+    else if (startOfFreeMem == NULL && __atomic_load_n(&list->lazyBlocks, __ATOMIC_RELAXED))
     {
-        // Check the left one
-        void *leftBuddy = (char *)resurrectedBuddy->currentLocation - e2size(exponent);
-
-        // fprintf(stdout, "Looking for left buddy: %p\n", leftBuddy);
+        // Nothing is big enough, but merging what was freed lazily may make something
+        mergelazy(list, base, upper);
+        startOfFreeMem = listblock(list, e, upper);
+    }
 
-        // Set the baseAddressOfBoth to the left buddy
-        *baseAddressOfBoth = leftBuddy;
+    // Still nothing, grow the pool and try the wilderness once more
+    if (startOfFreeMem == NULL && growpool(list, base, e, upper))
+    {
+        startOfFreeMem = list->mode == FREELIST_LOCKFREE ? stackbump(list, base, e, upper) : bumpblock(list, base, e, upper);
+    }
 
-        // Look to see if the address is in the free blocks
-        return lookforaddress(startOfList, leftBuddy);
+    // The pool is out of memory for this size
+    if (startOfFreeMem == NULL)
+    {
+        return NULL;
     }
+
+    // Record the size of the block for freelistsize() and freelistfree()
+    list->orders[((char *)startOfFreeMem - (char *)base) >> l] = e + 1;
+
+    // Block has been allocated
+    return startOfFreeMem;
 }
 
-// Recursively builds up the freelist until it cannot
-// @param *resurrectedBuddy = The buddy that was unallocated
-// @param **buddies = The array of all the buddy list heads
-// @param bitmap = A bitmap at the exponent level
+// Allocates many blocks of the same size, splitting one big block for as many
+// of them as it holds instead of splitting down once per block
+// The blocks of a big block are handed out in address order from its start,
+// and the rest of it goes back on the lists as the biggest blocks that fit
+// @param f = A freelist
 // @param *base = The base address of the pool
-// @param *mem = The location of where the buddy was freed
-// @param exponent = Block size exponent
-// @param upper = Upper exponent bounds
-// @param lower = Lower exponent bounds
-void buildup(Buddy *resurrectedBuddy, Buddy **buddies, BBM bitmap, void *base, void *mem, int exponent, int upper, int lower)
+// @param e = Requested exponent
+// @param l = Lower exponent bound
+// @param n = How many blocks are wanted
+// @param **blocks = Where the blocks are stored (room for n)
+// @return Returns: size_t, how many blocks were allocated (fewer than n if the pool ran out)
+size_t freelistallocn(FreeList f, void *base, int e, int l, size_t n, void **blocks)
 {
-    // Get the startOfList
-    Buddy *startOfList = buddies[exponent];
-
-    // Upper exponent that searches for the upper level
-    int upperExponentLevel = exponent + 1;
+    // Validating the freelist
+    if (!f)
+    {
+        // Outputting error message
+        fprintf(stderr, "Freelist is not valid!");
+        exit(1);
+    }
 
-    // Result from the lookfor()
-    int lookfor = -1;
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
 
-    // Got to find out the buddy I just brought back
-    int leftorright = leftorrightbuddy(resurrectedBuddy, base, e2size(upperExponentLevel));
+    // Grab upper exponent
+    const int upper = list->managementData[1];
 
-    // The base address of the left and right buddy
-    // Ex: ...-->[Left]-->[Right]-->...
-    // ----------^Base^----------------------------
-    void *baseAddressOfBoth = NULL;
+    const size_t blockSize = e2size(e);
+    size_t count = 0;
 
-    // Check if we are at the top
-    if (upperExponentLevel > upper)
+    while (count < n)
     {
-        // Look to see if buddy exists
-        lookfor = findbuddy(leftorright, &baseAddressOfBoth, startOfList, resurrectedBuddy, exponent);
-
-        if (lookfor)
+        // The smallest block that holds everything that is left (or the highest level)
+        int exponent = e;
+        while (exponent < upper && ((size_t)1 << (exponent - e)) < n - count)
         {
-            // Buddy is found! You can clear the map.
-            // Change the bitmap as this is the last free possible
-            bbmclr(bitmap, base, mem, exponent);
+            exponent++;
         }
 
-        // Building complete
-        return;
-    }
+        // Settling for smaller blocks if the pool has none that big, only the requested
+        // size is worth merging or growing the pool for
+        void *block = NULL;
+        while (block == NULL && exponent > e)
+        {
+            block = takeblock(list, base, exponent, upper);
+            exponent -= block == NULL;
+        }
+        if (block == NULL)
+        {
+            block = freelistalloc(f, base, e, l);
+        }
 
-    // Now we know if the freedbuddy is the left or right of the pair
-    // Check the other one
-    lookfor = findbuddy(leftorright, &baseAddressOfBoth, startOfList, resurrectedBuddy, exponent);
+        // Out of memory for this size
+        if (block == NULL)
+        {
+            break;
+        }
 
-    // Is the buddy found?
-    if (lookfor)
-    {
-        // Grab the bitmap level of the buddy that was brought back
-        BBM currentBitmap = resurrectedBuddy->bitmap;
+        // Handing out the blocks at its start
+        size_t taken = (size_t)1 << (exponent - e);
+        if (taken > n - count)
+        {
+            taken = n - count;
+        }
 
-        // A pair of buddies are found, which means they will be built up so the bitmap should reflect that change
-        bbmclr(currentBitmap, base, mem, exponent);
+        for (size_t i = 0; i < taken; i++)
+        {
+            blocks[count] = (char *)block + i * blockSize;
+            list->orders[((char *)blocks[count] - (char *)base) >> l] = e + 1;
+            count++;
+        }
 
-        // Remove the two buddies from the lower level so they can be tranferred to a higher level
-        Buddy *currentBuddy = startOfList;
+        // The rest of it is freed (the left buddy of every piece holds blocks that were just handed out, so none of it merges)
+        releaserange(list, base, (char *)block + taken * blockSize, (char *)block + e2size(exponent), upper);
+    }
 
-        // Loop through whole list of buddies
-        while (1)
-        {
+    return count;
+}
 
-            // Found the base address to the pair of buddies
-            if (currentBuddy->currentLocation == baseAddressOfBoth)
-            {
-                // Left buddy found!
-                // Remove the pair
-                // fprintf(stdout, "Base buddy found! Base location at: %p\n", currentBuddy->currentLocation);
-                removenodepair(currentBuddy, buddies, base, exponent, currentBuddy->currentLocation == startOfList->currentLocation);
+// Takes up to n blocks of the same size for a cache to hand out, the free blocks
+// of that size first (under one lock), then one at a time the way freelistalloc
+// finds them, without merging anything or growing the pool unless nothing at all is free
+// @param f = A freelist
+// @param *base = The base address of the pool
+// @param e = Requested exponent
+// @param l = Lower exponent bound
+// @param n = How many blocks are wanted
+// @param **blocks = Where the blocks are stored (room for n)
+// @return Returns: size_t, how many blocks were taken (0 if the pool is out of memory for this size)
+size_t freelisttake(FreeList f, void *base, int e, int l, size_t n, void **blocks)
+{
+    // Validating the freelist
+    if (!f)
+    {
+        // Outputting error message
+        fprintf(stderr, "Freelist is not valid!");
+        exit(1);
+    }
 
-                // No more looping
-                break;
-            }
-            else
-            {
-                // Keep iterating
-                currentBuddy = currentBuddy->nextBuddy;
-            }
-        }
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
 
-        // Get the buddy head at the next level exponent
-        Buddy *currentBuddyLevel = buddies[upperExponentLevel];
+    // Grab upper exponent
+    const int upper = list->managementData[1];
 
-        // Update the bitmap
-        currentBitmap = currentBuddyLevel->bitmap;
+    // The blocks of the size that are already free
+    size_t count = allocationn(list, e, n, blocks);
 
-        // Call another unallocation on the higher level
-        Buddy *freedBuddy = unallocation(buddies, currentBitmap, base, baseAddressOfBoth, upperExponentLevel, lower, isemptylist(currentBuddyLevel));
+    // Then the wilderness or a split bigger block, only as long as that is cheap
+    void *block;
+    while (count < n && (block = takeblock(list, base, e, upper)))
+    {
+        blocks[count++] = block;
+    }
 
-        // Possibly could use some recursion...
-        // RECURSION TIME
-        return buildup(freedBuddy, buddies, currentBitmap, base, baseAddressOfBoth, upperExponentLevel, upper, lower);
+    // Nothing at all was free, this one merges or grows the pool if it has to
+    if (count == 0 && (block = freelistalloc(f, base, e, l)))
+    {
+        blocks[count++] = block;
     }
-    else
+
+    for (size_t i = 0; i < count; i++)
     {
-        // Buddy not found :(
-        // fprintf(stdout, "Buddy not found :(\n");
-        return;
+        list->orders[((char *)blocks[i] - (char *)base) >> l] = e + 1;
     }
+
+    return count;
 }
 
 // Frees a block of memory in the freelist
@@ -1063,9 +1557,6 @@ void buildup(Buddy *resurrectedBuddy, Buddy **buddies, BBM bitmap, void *base, v
 // @param l = Lower exponent bound
 void freelistfree(FreeList f, void *base, void *mem, int e, int l)
 {
-    // Aliasing
-    int exponent = e, lower = l;
-
     // Validating the freelist
     if (!f)
     {
@@ -1088,86 +1579,312 @@ void freelistfree(FreeList f, void *base, void *mem, int e, int l)
         exit(1);
     }
 
-    // Grab the lists (array of pointers)
-    Buddy **buddies = list->buddies;
-
-    // Get the head of the list for the buddy level
-    Buddy *currentBuddyLevel = buddies[exponent];
-
-    // Get the bitmap at the current level
-    BBM currentBitmap = currentBuddyLevel->bitmap;
-
     // When you are freeing something, you practially have the
     // Buddy, just not in an explicit struct.
     // When you free a node you have to check its buddy since
     // a buddy contains two nodes...
     // That is because a bitmap represents two nodes at one bit location
 
-    // Need to check if it should be built up, if not just return from the dead
-    // This will require some understanding of how to restructure the list
+    // The block is no longer allocated
+    list->orders[((char *)mem - (char *)base) >> l] = 0;
+
+    // Lock-free levels leave merging for later, it just goes on the stack
+    if (list->mode == FREELIST_LOCKFREE)
+    {
+        stackpush(list, mem, e);
+        return;
+    }
+
+    // A level with slack keeps it as it is, so the next allocation of the size does not split again
+    if (list->levels[e].slack)
+    {
+        lockorder(list, e);
+        int kept = list->levels[e].lazyCount < list->levels[e].slack;
+        if (kept)
+        {
+            pushlazy(list, mem, e);
+        }
+        unlockorder(list, e);
 
-    // First bring back the buddy via unallocation
-    Buddy *resurrectedBuddy = unallocation(buddies, currentBitmap, base, mem, exponent, lower, isemptylist(currentBuddyLevel));
+        if (kept)
+        {
+            return;
+        }
+    }
 
-    // Recursion to build it back up
-    buildup(resurrectedBuddy, buddies, currentBitmap, base, mem, exponent, upper, lower);
+    // Merge it with its buddies as far as possible and put it back on a list
+    buildup(list, base, mem, e, upper);
 
     // Block has been freed!
     return;
 }
 
-// Recursively goes down bitmaps to find the respective exponent
-// @param **buddies = An array of buddies via pointers
+// Frees many blocks of memory in the freelist at once
+// The blocks come sorted by address, so buddies that are both being freed are
+// next to each other and are merged right there (again and again, as far
+// as they go), only the merged blocks are then put on the lists
+// @param f = A freelist
 // @param *base = The base address of the pool
-// @param *mem = The offset address of where the bit is
-// @param upper = Upper exponent bound
-// @param lower = Lower exponent bound
-// @param currentExponent = The current exponent level in the buddy list being checked
-// @return Returns: size_t, The size of the exponent
-size_t exponentsearcher(Buddy **buddies, void *base, void *mem, int upper, int lower, int currentExponent)
+// @param **blocks = The allocated blocks, sorted by address (used as scratch)
+// @param n = How many blocks there are
+// @param l = Lower exponent bound
+void freelistfreen(FreeList f, void *base, void **blocks, size_t n, int l)
 {
+    // Validating the freelist
+    if (!f)
+    {
+        // Outputting error message
+        fprintf(stderr, "Freelist is not valid!");
+        exit(1);
+    }
+
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
+
+    // Grabbing upper exponent bounds
+    const int upper = list->managementData[1];
+
+    // The merged blocks are kept as a stack at the front of the array, their
+    // exponents stay in the order table until they are freed for real
+    // Only the top two can ever be buddies, anything under them was checked already
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        // The same block twice
+        if (i > 0 && blocks[i] == blocks[i - 1])
+        {
+            // Outputting error messsage
+            fprintf(stderr, "Memory is not an allocated block!\n");
+            exit(1);
+        }
+
+        blocks[merged++] = blocks[i];
+
+        while (merged > 1)
+        {
+            char *left = blocks[merged - 2], *right = blocks[merged - 1];
+            unsigned char *leftOrder = &list->orders[(left - (char *)base) >> l];
+            unsigned char *rightOrder = &list->orders[(right - (char *)base) >> l];
+            int exponent = *leftOrder - 1;
+
+            // Not a pair of buddies of the same size (or the highest level, which never merges)
+            if (*rightOrder != *leftOrder || exponent >= upper || baddrinv(base, left, exponent) != right)
+            {
+                break;
+            }
+
+            // Both were allocated, so their pair bit is clear and stays clear
+            *rightOrder = 0;
+            *leftOrder = exponent + 2;
+            merged--;
+        }
+    }
 
-    // BASE CASE: Have we reached the end of the buddies?
-    if (currentExponent < lower)
+    // Freeing what is left like any other block
+    for (size_t i = 0; i < merged; i++)
     {
-        // This is the end of the line, son
-        // That means the lowest level of the buddies is where the allocation occured
+        unsigned char *order = &list->orders[((char *)blocks[i] - (char *)base) >> l];
+        int exponent = *order - 1;
+        *order = 0;
+
+        if (list->mode == FREELIST_LOCKFREE)
+        {
+            stackpush(list, blocks[i], exponent);
+        }
+        else
+        {
+            buildup(list, base, blocks[i], exponent, upper);
+        }
+    }
+}
 
-        // The lowest exponent it is then!
-        return currentExponent + 1;
+// Resizes an allocated block where it is
+// Shrinking frees the right half at every level on the way down, growing takes
+// the right buddy at every level on the way up, which has to be free on its
+// list (or never handed out, at the start of the wilderness)
+// @param f = A freelist
+// @param *base = The base address of the pool
+// @param *mem = Address of the block
+// @param e = Exponent of the block
+// @param newE = Exponent the block should have
+// @param l = Lower exponent bound
+// @return Returns: int, 1 if the block has been resized, 0 if it can not grow where it is (it is left as it was)
+int freelistresize(FreeList f, void *base, void *mem, int e, int newE, int l)
+{
+    // Validating the freelist
+    if (!f)
+    {
+        // Outputting error message
+        fprintf(stderr, "Freelist is not valid!");
+        exit(1);
     }
 
-    // Need to grab a bit map
-    // ? Maybe start at the top?
-    Buddy *currentBuddy = buddies[currentExponent];
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
 
-    // Grab bitmap at current level
-    BBM currentBitmap = currentBuddy->bitmap;
+    // Shrinking always works, the halves it gives back can not merge (their buddies are the block)
+    if (newE <= e)
+    {
+        list->orders[((char *)mem - (char *)base) >> l] = newE + 1;
+        splitblock(list, mem, newE, e);
+        return 1;
+    }
 
-    // Remember, if we are looking for allocated nodes that implys the bitmap
-    // will have that location marked with a '1'
+    // Growing needs the block to be the left buddy at every level up to the new one,
+    // and a lock-free level can not give up a block from the middle of its stack
+    if (list->mode == FREELIST_LOCKFREE || (((char *)mem - (char *)base) & (e2size(newE) - 1)))
+    {
+        return 0;
+    }
 
-    // Test to see if at the currentExponents level the bit is considered allocated
-    if (bbmtst(currentBitmap, base, mem, currentExponent))
+    int exponent = e;
+    while (exponent < newE)
     {
-        // Location is marked allocated
-        // Get new level to search
-        // fprintf(stdout, "Scanning %d level of bitmap!\n", currentExponent);
-        // bbmprt(currentBitmap);
+        // The block is allocated, so its pair bit is set only if the right buddy is on the list
+        char *buddy = (char *)mem + e2size(exponent);
+
+        lockorder(list, exponent);
+        if (bbmtst(list->pairmaps[exponent], base, mem, exponent))
+        {
+            // Taking it off, neither buddy of the pair is free now
+            removenode(list, (Buddy *)buddy, exponent);
+            togglepair(list, buddy, exponent);
+            unlockorder(list, exponent);
+
+            exponent++;
+            continue;
+        }
+        unlockorder(list, exponent);
+
+        // Otherwise everything up to the new size has to still be wilderness
+        lockwilderness(list);
+        if (buddy == list->wilderness && (char *)mem + e2size(newE) <= list->end)
+        {
+            setwilderness(list, (char *)mem + e2size(newE));
+            exponent = newE;
+        }
+        unlockwilderness(list);
 
-        // This means we need to go to a lower level
-        // WOOP WOOP THIS IS RECURSION
-        return exponentsearcher(buddies, base, mem, upper, lower, currentExponent - 1);
+        break;
     }
-    else
+
+    // Could not grow all the way, the buddies that were taken go back
+    if (exponent < newE)
+    {
+        splitblock(list, mem, e, exponent);
+        return 0;
+    }
+
+    // Record the new size of the block
+    list->orders[((char *)mem - (char *)base) >> l] = newE + 1;
+    return 1;
+}
+
+// Sets how many freed blocks a level keeps without merging them (lazy merging)
+// Once a level holds that many, freeing more of them merges as usual, and all
+// of them are merged when an allocation finds nothing big enough
+// (lock-free freelists always put merging off, so they do not use it)
+// @param f = A freelist
+// @param e = The level
+// @param slack = How many blocks it keeps, 0 to merge right away
+void freelistslack(FreeList f, int e, size_t slack)
+{
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
+
+    // The highest blocks never merge anyway
+    if (e >= list->managementData[1])
     {
-        // Location is marked free
-        // This means the level we are looking at is not where the alloction occured
-        // and that implys any levels below are also not where the allocation is
+        return;
+    }
+
+    lockorder(list, e);
+    list->levels[e].slack = slack;
+    unlockorder(list, e);
+}
+
+// Sets how many blocks a level is refilled with when it runs empty, cut out of
+// one block instead of splitting a block down for every allocation
+// (the blocks wait on the level's lazy list, lock-free freelists do not refill)
+// @param f = A freelist
+// @param e = The level
+// @param n = How many blocks (rounded up to a power of 2, at most a highest level block), 1 to split one at a time
+void freelistrefill(FreeList f, int e, size_t n)
+{
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
 
-        // Must be on the level above!
-        return currentExponent + 1;
+    // Grab upper exponent
+    const int upper = list->managementData[1];
+
+    // Order of the block that holds n blocks of the level
+    int exponent = n > 1 ? e + size2e(n) : 0;
+    if (exponent > upper)
+    {
+        exponent = upper;
     }
+
+    lockorder(list, e);
+    list->levels[e].refillOrder = exponent > e ? exponent : 0;
+    unlockorder(list, e);
+}
+
+// Records whether a block is allocated without putting it on or taking it off
+// a list, used for blocks that are held somewhere else (like a thread's cache)
+// @param f = A freelist
+// @param *base = The base address of the pool
+// @param *mem = Address of the block
+// @param e = Exponent of the block, or -1 if it is not allocated
+// @param l = Lower exponent bound
+void freelistmark(FreeList f, void *base, void *mem, int e, int l)
+{
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
+
+    // Same encoding freelistalloc() uses, 0 is not allocated
+    list->orders[((char *)mem - (char *)base) >> l] = e + 1;
+}
+
+// Marks an allocated block as queued to be freed later, so it is not an
+// allocated block any more as far as freeing it (again) is concerned
+// Two threads freeing the same block at once can not both queue it
+// @param f = A freelist
+// @param *base = The base address of the pool
+// @param *mem = Address of the block
+// @param l = Lower exponent bound
+void freelistqueue(FreeList f, void *base, void *mem, int l)
+{
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
+
+    unsigned char *order = &list->orders[((char *)mem - (char *)base) >> l];
+
+    // Only the thread that sets the mark gets to queue the block
+    unsigned char old = __atomic_load_n(order, __ATOMIC_RELAXED);
+    do
+    {
+        // Freed or queued already
+        if (old == 0 || old & ORDER_QUEUED)
+        {
+            // Outputting error messsage
+            fprintf(stderr, "Memory is not an allocated block!\n");
+            exit(1);
+        }
+    } while (!__atomic_compare_exchange_n(order, &old, old | ORDER_QUEUED, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Takes the queued mark off a block, it is an allocated block again (for the
+// thread that took it off the queue to free it)
+// @param f = A freelist
+// @param *base = The base address of the pool
+// @param *mem = Address of the block
+// @param l = Lower exponent bound
+void freelistunqueue(FreeList f, void *base, void *mem, int l)
+{
+    // Grab the list representation of the freelist
+    List *list = (List *)f;
+
+    list->orders[((char *)mem - (char *)base) >> l] &= ~ORDER_QUEUED;
 }
 
 // Grabs the size of an allocated block in the freelist
@@ -1177,16 +1894,10 @@ size_t exponentsearcher(Buddy **buddies, void *base, void *mem, int upper, int l
 // @param *mem = Address of the location where the block of memory is
 // @param l = Lower exponent bound
 // @param u = Upper exponent bound
-// @return Returns: int, size of the block
+// @return Returns: int, size of the block in exponent form
 int freelistsize(FreeList f, void *base, void *mem, int l, int u)
 {
 
-    // Aliasing
-    const int lower = l, upper = u;
-
-    // Used to track current level of exponent on buddies
-    int currentExponent = upper;
-
     // Validating the freelist
     if (!f)
     {
@@ -1206,34 +1917,34 @@ int freelistsize(FreeList f, void *base, void *mem, int l, int u)
         exit(1);
     }
 
-    // Grab the list of buddies (array of pointers)
-    Buddy **buddies = list->buddies;
-
-    // Remember, if we are looking for allocated nodes that implys the bitmap
-    // will have that location marked with a '1'
-    // Example:
-    // Freelist[3] = 0000001
-    // Freelist[4] = 0000001
-    // Freelist[5] = 0000001
-    // Since all buddies in the first position are marked allocated that implies
-    // the allocation occured in the Freelist[3] layer as the mem offset accounts for it
-    // due to bitmaps work on offsets its nice because you dont have to worry about
-    // a stray allocated block caught in this algorithm.
-    //
-    // For example, If you had a double allocation occur in Freelist[5] on the same
-    // buddy bitmap value, it doesn't matter because that second allocation would reflect
-    // on the second bitmap value in Freelist[4] which is marked as free. That implies
-    // the size you are looking for must be on Freelist[5] because that is the only one
-    // where the bitmap is marked 1 when you get the off set of the base and mem
-
-    // Maybe use recursion and save the exponent
-    int exponent = exponentsearcher(buddies, base, mem, upper, lower, currentExponent);
+    // Offset of the block from the base of the pool
+    size_t offset = (char *)mem - (char *)base;
+
+    // The block has to be inside the pool and on a smallest block boundary
+    if ((char *)mem < (char *)base || offset >= list->size || offset & (e2size(l) - 1))
+    {
+        // Outputting error messsage
+        fprintf(stderr, "Memory is not a block in this pool!\n");
+        exit(1);
+    }
+
+    // The order table remembers the exponent of every allocated block
+    int exponent = list->orders[offset >> l] - 1;
+
+    // Nothing was allocated here (or it is waiting to be freed)
+    if (exponent < 0 || list->orders[offset >> l] & ORDER_QUEUED)
+    {
+        // Outputting error messsage
+        fprintf(stderr, "Memory is not an allocated block!\n");
+        exit(1);
+    }
 
     // Returning the exponent!
     return exponent;
 }
 
 // Outputting tool of the freelist, useful for debugging
+// (does not lock anything, so other threads should not be using the freelist)
 // @param f = A freelist
 // @param l = Lower exponent bound
 // @param u = Upper exponent bound
@@ -1254,9 +1965,6 @@ void freelistprint(FreeList f, int l, int u)
     // Grab the list representation of the freelist
     List *list = (List *)f;
 
-    // Grab the lists (array of pointers)
-    Buddy **buddies = list->buddies;
-
     // 2 Big things need to be output
     // 1. Buddy Bitmap
     // 2. All lists and their nodes
@@ -1265,18 +1973,12 @@ void freelistprint(FreeList f, int l, int u)
     // These will be printed off in by there blocks
     fprintf(stdout, "Printout the bitmaps by level!\n");
 
-    // Outputting each bitmap one by one
-    for (int i = lower; i <= upper; i++)
+    // Outputting each bitmap one by one (the highest level never merges, so it has none)
+    for (int i = lower; i < upper; i++)
     {
-        // Get the current buddy
-        Buddy *currentBuddy = buddies[i];
-
-        // Grab the bitmap for that buddies level
-        BBM bitmap = currentBuddy->bitmap;
-
-        // Print out the bitmap
+        // Print out the bitmap for that level
         fprintf(stdout, "Freelist[%d]: ", i);
-        bbmprt(bitmap);
+        bbmprt(list->pairmaps[i]);
     }
 
     // Whitespace
@@ -1291,46 +1993,53 @@ void freelistprint(FreeList f, int l, int u)
     for (int i = lower; i <= upper; i++)
     {
         // Get the current buddy
-        Buddy *currentBuddy = buddies[i];
+        Buddy *currentBuddy = list->levels[i].head;
 
         // Printing out current index of buddy lists
-        fprintf(stdout, "Freelist[%d] (Size: %ld): ", i, e2size(i));
+        fprintf(stdout, "Freelist[%d] (Size: %zu): ", i, e2size(i));
+
+        // Lock-free levels are linked by index instead
+        for (uint64_t index = list->mode == FREELIST_LOCKFREE ? list->levels[i].stack & list->stackMask : 0; index; index = *(uint64_t *)stackblock(list, index))
+        {
+            fprintf(stdout, "[%p]-------->", stackblock(list, index));
+        }
 
-        // Printing out the current buddy
-        // fprintf(stdout, "Current Buddy Location: %p", currentBuddy->currentLocation);
+        // Address ordered levels are walked through their bitmap, lowest block first
+        for (void *block = list->freemaps[i] ? obmfirst(list->freemaps[i], list->baseAddress, list->baseAddress, i) : NULL; block; block = obmfirst(list->freemaps[i], list->baseAddress, (char *)block + e2size(i), i))
+        {
+            fprintf(stdout, "[%p]-------->", block);
+        }
 
         // Loop through all buddies in the singly linked list
-        // Using index to note base
-        // int index = 0;
         while (currentBuddy)
         {
-            // At base address (and increment)
-            // if (index++ == 0)
-            // {
-            //     // Stating base at the list
-            //     fprintf(stdout, "[BASE]-------->");
-            // }
-            // else
-            // {
-            //     // Output current location
-            //     fprintf(stdout, "[%p]-------->", currentBuddy->currentLocation);
-            // }
-
-            fprintf(stdout, "[%p]-------->", currentBuddy->currentLocation);
+            // The node's address is the block's address
+            fprintf(stdout, "[%p]-------->", (void *)currentBuddy);
 
             // Update currentBuddy
             currentBuddy = currentBuddy->nextBuddy;
         }
 
-        // Reached end of list (presumably)
-        if (!currentBuddy)
+        // Then the ones that were freed without merging
+        for (currentBuddy = list->levels[i].lazy; currentBuddy; currentBuddy = currentBuddy->nextBuddy)
         {
-            // Append 'NULL' to the end
-            // Since it is pointing at nothing
-            fprintf(stdout, "NULL\n");
+            fprintf(stdout, "[%p (lazy)]-------->", (void *)currentBuddy);
         }
+
+        // Reached end of list, append 'NULL' to the end
+        // Since it is pointing at nothing
+        fprintf(stdout, "NULL\n");
+    }
+
+    // The part of the pool that has not been cut into blocks yet
+    fprintf(stdout, "Wilderness: [%p] (Size: %ld)\n", (void *)list->wilderness, (long)(list->end - list->wilderness));
+
+    // The part of a growable pool that has not been committed yet
+    if (list->limit > list->end)
+    {
+        fprintf(stdout, "Reserved: [%p] (Size: %ld)\n", (void *)list->end, (long)(list->limit - list->end));
     }
 
     // Outputting of freelist complete!
     return;
-}
\ No newline at end of file
+}
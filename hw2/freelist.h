@@ -5,12 +5,34 @@
 
 typedef void *FreeList;
 
-extern FreeList freelistcreate(size_t size, int l, int u, void *base);
+// How a freelist can be shared between threads
+// PLAIN: not at all, LOCKED: a lock per level, LOCKFREE: every level is a lock-free stack
+#define FREELIST_PLAIN 0
+#define FREELIST_LOCKED 1
+#define FREELIST_LOCKFREE 2
+
+extern size_t freelistspace(size_t size, int l, int u, int ordered);
+extern FreeList freelistcreate(size_t size, size_t limit, int l, int u, void *base, void *meta, int mode, int ordered);
 extern void freelistdelete(FreeList f, int l, int u);
+extern void freelistlockall(FreeList f);
+extern void freelistunlockall(FreeList f);
+
+extern int freelistminexponent();
+extern int freelistmaxexponent();
+extern size_t freelistmaxsize(int l, int mode);
 
 extern void *freelistalloc(FreeList f, void *base, int e, int l);
+extern size_t freelistallocn(FreeList f, void *base, int e, int l, size_t n, void **blocks);
+extern size_t freelisttake(FreeList f, void *base, int e, int l, size_t n, void **blocks);
 extern void freelistfree(FreeList f, void *base, void *mem, int e, int l);
+extern void freelistfreen(FreeList f, void *base, void **blocks, size_t n, int l);
+extern int freelistresize(FreeList f, void *base, void *mem, int e, int newE, int l);
 
+extern void freelistslack(FreeList f, int e, size_t slack);
+extern void freelistrefill(FreeList f, int e, size_t n);
+extern void freelistmark(FreeList f, void *base, void *mem, int e, int l);
+extern void freelistqueue(FreeList f, void *base, void *mem, int l);
+extern void freelistunqueue(FreeList f, void *base, void *mem, int l);
 extern int freelistsize(FreeList f, void *base, void *mem, int l, int u);
 extern void freelistprint(FreeList f, int l, int u);
 
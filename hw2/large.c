@@ -0,0 +1,258 @@
+/**
+ * Blocks too big for a balloc pool, each mapped on its own.
+ *
+ * A block is the start of its own mapping, and the record that keeps track of
+ * it sits in the last bytes of that mapping, so nothing has to be allocated
+ * to remember it. A pool's records are linked together, which is how a
+ * block is recognised when it is freed (there are only ever a few of them).
+ * Growing or shrinking one is done with mremap(), so its bytes are never copied.
+ *
+ * @version 1.0
+ *
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "large.h"
+#include "utils.h"
+
+// What is kept about a block, at the end of its mapping
+struct Large
+{
+
+    // The block (and its mapping)
+    void *mem;
+
+    // Length of the mapping
+    size_t mappedSize;
+
+    // The pool's other blocks
+    struct Large *next;
+    struct Large *prev;
+
+} typedef Large;
+
+// Guards every pool's list of blocks
+static pthread_mutex_t largeLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bytes of a mapping that can be used by the block
+// @param *large = The block's record
+// @return Returns: size_t, the size of the block
+static size_t usable(Large *large)
+{
+    return large->mappedSize - sizeof(Large);
+}
+
+// Writes a block's record at the end of its mapping and adds it to the pool's list (lock held)
+// @param *larges = The pool's blocks
+// @param *mem = The block
+// @param mappedSize = Length of its mapping
+static void addlarge(Larges *larges, void *mem, size_t mappedSize)
+{
+    Large *large = (Large *)((char *)mem + mappedSize - sizeof(Large));
+    large->mem = mem;
+    large->mappedSize = mappedSize;
+    large->prev = NULL;
+    large->next = *larges;
+    if (large->next)
+    {
+        large->next->prev = large;
+    }
+    *larges = large;
+}
+
+// Takes a block's record off the pool's list (lock held)
+// @param *larges = The pool's blocks
+// @param *large = The record
+static void removelarge(Larges *larges, Large *large)
+{
+    if (large->prev)
+    {
+        large->prev->next = large->next;
+    }
+    else
+    {
+        *larges = large->next;
+    }
+
+    if (large->next)
+    {
+        large->next->prev = large->prev;
+    }
+}
+
+// Finds a block's record (lock held)
+// @param *larges = The pool's blocks
+// @param *mem = The block
+// @return Returns: Large *, the record, or NULL if the block is not one of them
+static Large *findlarge(Larges *larges, void *mem)
+{
+    for (Large *large = *larges; large; large = large->next)
+    {
+        if (large->mem == mem)
+        {
+            return large;
+        }
+    }
+
+    return NULL;
+}
+
+// Bytes to map for a block (with room for its record at the end)
+// @param size = Size of the block
+// @return Returns: size_t, the length of the mapping, or 0 if it is too big to ever map
+static size_t mapping(size_t size)
+{
+    if (size > SIZE_MAX / 2)
+    {
+        return 0;
+    }
+
+    return roundup(size + sizeof(Large), pagesize());
+}
+
+// Maps a block on its own
+// @param *larges = The pool's blocks
+// @param size = Size of the block
+// @param align = What the block's address is aligned to (a power of 2, at least a page is always given)
+// @return Returns: void *, the block, or NULL if it could not be mapped
+void *largealloc(Larges *larges, size_t size, size_t align)
+{
+    size_t mappedSize = mapping(size);
+    if (mappedSize == 0)
+    {
+        return NULL;
+    }
+
+    // Mapping extra so an aligned start can be picked, and giving back what is left over on either side
+    size_t slack = align > pagesize() ? align - pagesize() : 0;
+    if (slack > SIZE_MAX - mappedSize)
+    {
+        return NULL;
+    }
+    char *region = mmap(0, mappedSize + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    char *mem = (char *)roundup((size_t)region, align > pagesize() ? align : pagesize());
+    if (mem > region)
+    {
+        mmfree(region, mem - region);
+    }
+    if (region + slack > mem)
+    {
+        mmfree(mem + mappedSize, region + slack - mem);
+    }
+
+    pthread_mutex_lock(&largeLock);
+    addlarge(larges, mem, mappedSize);
+    pthread_mutex_unlock(&largeLock);
+
+    return mem;
+}
+
+// Unmaps a block if it is one of the pool's
+// @param *larges = The pool's blocks
+// @param *mem = The block
+// @return Returns: int, 1 if it was unmapped, 0 if it is not one of the pool's blocks
+int largefree(Larges *larges, void *mem)
+{
+    pthread_mutex_lock(&largeLock);
+    Large *large = findlarge(larges, mem);
+    if (large)
+    {
+        removelarge(larges, large);
+    }
+    pthread_mutex_unlock(&largeLock);
+
+    if (large == NULL)
+    {
+        return 0;
+    }
+
+    mmfree(mem, large->mappedSize);
+    return 1;
+}
+
+// Grabs the size of a block
+// @param *larges = The pool's blocks
+// @param *mem = The block
+// @return Returns: size_t, the bytes the block can hold, or 0 if it is not one of the pool's blocks
+size_t largesize(Larges *larges, void *mem)
+{
+    pthread_mutex_lock(&largeLock);
+    Large *large = findlarge(larges, mem);
+    size_t size = large ? usable(large) : 0;
+    pthread_mutex_unlock(&largeLock);
+
+    return size;
+}
+
+// Grows or shrinks a block by remapping it, so its bytes are not copied (it may move)
+// @param *larges = The pool's blocks
+// @param *mem = The block (already checked to be one of the pool's)
+// @param size = New size of the block
+// @return Returns: void *, the block, or NULL if it could not be remapped (it is left as it was)
+void *largerealloc(Larges *larges, void *mem, size_t size)
+{
+    size_t mappedSize = mapping(size);
+    if (mappedSize == 0)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&largeLock);
+    Large *large = findlarge(larges, mem);
+
+    // Same number of pages, nothing to do
+    if (large->mappedSize == mappedSize)
+    {
+        pthread_mutex_unlock(&largeLock);
+        return mem;
+    }
+
+    // The record moves to the new end of the mapping
+    removelarge(larges, large);
+    const size_t oldSize = large->mappedSize;
+    void *moved = mremap(mem, oldSize, mappedSize, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED)
+    {
+        addlarge(larges, mem, oldSize);
+        pthread_mutex_unlock(&largeLock);
+        return NULL;
+    }
+
+    addlarge(larges, moved, mappedSize);
+    pthread_mutex_unlock(&largeLock);
+
+    return moved;
+}
+
+// Unmaps all of a pool's blocks
+// @param *larges = The pool's blocks
+void largedelete(Larges *larges)
+{
+    pthread_mutex_lock(&largeLock);
+    while (*larges)
+    {
+        Large *large = *larges;
+        removelarge(larges, large);
+        mmfree(large->mem, large->mappedSize);
+    }
+    pthread_mutex_unlock(&largeLock);
+}
+
+// Takes the lock that guards every pool's blocks (no other lock is taken while it is held)
+void largelockall()
+{
+    pthread_mutex_lock(&largeLock);
+}
+
+// Gives back the lock largelockall() took
+void largeunlockall()
+{
+    pthread_mutex_unlock(&largeLock);
+}
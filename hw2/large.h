@@ -0,0 +1,18 @@
+#ifndef LARGE_H
+#define LARGE_H
+
+#include <stddef.h>
+
+// A pool's blocks that are too big for it are found through the address of a
+// void * the pool owns (NULL when it has none)
+typedef void *Larges;
+
+extern void  *largealloc(Larges *larges, size_t size, size_t align);
+extern int    largefree(Larges *larges, void *mem);
+extern size_t largesize(Larges *larges, void *mem);
+extern void  *largerealloc(Larges *larges, void *mem, size_t size);
+extern void   largedelete(Larges *larges);
+extern void   largelockall();
+extern void   largeunlockall();
+
+#endif
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "balloc.h"
 
@@ -35,7 +36,7 @@ void testpool1()
 
     // What size is the allocation?
     // Test 1.5: Allocation 1 size
-    fprintf(stdout, "The size of the allocation is: %d\n", bsize(pool1, allocation1));
+    fprintf(stdout, "The size of the allocation is: %zu\n", bsize(pool1, allocation1));
 
     // Allocation should be reflected in the output
     bprint(pool1);
@@ -46,7 +47,7 @@ void testpool1()
 
     // What size is the allocation?
     // Test 2.5: Allocation 2 size
-    fprintf(stdout, "The size of the allocation is: %d\n", bsize(pool1, allocation2));
+    fprintf(stdout, "The size of the allocation is: %zu\n", bsize(pool1, allocation2));
 
     // Allocation should be reflected in the output
     bprint(pool1);
@@ -119,8 +120,9 @@ void testpool3()
     // pool3 tests
 
     // Small pool
+    // Note: l = 1 is raised to the smallest block that can hold a free list node
     fprintf(stdout, "\nRunning tests for pool3!\n");
-    Balloc pool3 = bcreate(32, 1, 4);
+    Balloc pool3 = bcreate(128, 1, 5);
 
     // Outputting start of pool3 (no operations)
     bprint(pool3);
@@ -157,6 +159,592 @@ void testpool3()
     return;
 }
 
+// Out of memory handler used by testpool4(), frees the block it was given once
+int freeonce(Balloc pool, size_t size, void *arg)
+{
+    // Grab the block to give back
+    void **held = (void **)arg;
+
+    // Nothing left to free, give up
+    if (*held == NULL)
+    {
+        return 0;
+    }
+
+    // Make room and ask for a retry
+    fprintf(stdout, "Handler called for %zu bytes, freeing a block!\n", size);
+    bfree(pool, *held);
+    *held = NULL;
+    return 1;
+}
+
+void testpool4()
+{
+    // pool4 tests
+
+    // Pool that is easy to fill up
+    fprintf(stdout, "\nRunning tests for pool4!\n");
+    Balloc pool4 = bcreate(64, 4, 5);
+
+    // Test 12: Filling the pool
+    fprintf(stdout, "\nAllocations of size 32, 2 times!\n");
+    void *allocation1 = balloc(pool4, 32);
+    void *allocation2 = balloc(pool4, 32);
+
+    // Test 13: Out of memory returns NULL instead of exiting
+    void *allocation3 = balloc(pool4, 16);
+    fprintf(stdout, "Allocation on a full pool returned: %p (should be nil)\n", allocation3);
+
+    // Test 14: Too big of a request is mapped on its own, and can be grown without copying
+    void *allocation4 = balloc(pool4, 64);
+    fprintf(stdout, "Allocation above 2^u returned: %p (should not be nil)\n", allocation4);
+    fprintf(stdout, "The size of the allocation above 2^u is: %zu (should be at least 64)\n", bsize(pool4, allocation4));
+    strcpy(allocation4, "kept");
+    allocation4 = brealloc(pool4, allocation4, e2size(20));
+    fprintf(stdout, "Allocation above 2^u grown to 2^20 still holds: %s (should be kept)\n", (char *)allocation4);
+    bfree(pool4, allocation4);
+
+    // Test 15: Out of memory handler makes room and the allocation is retried
+    bsethandler(pool4, freeonce, &allocation1);
+    allocation3 = balloc(pool4, 16);
+    fprintf(stdout, "Allocation after the handler returned: %p (should not be nil)\n", allocation3);
+
+    // Output should reflect the 32 and 16 allocations
+    bprint(pool4);
+
+    // Handler has nothing left to free, so the pool gives up
+    allocation4 = balloc(pool4, 32);
+    fprintf(stdout, "Allocation after the handler gave up returned: %p (should be nil)\n", allocation4);
+
+    // Tests complete
+    bfree(pool4, allocation2);
+    bfree(pool4, allocation3);
+    bdelete(pool4);
+
+    fprintf(stdout, "\nPool4 tests complete!\n");
+
+    return;
+}
+
+void testpool5()
+{
+    // pool5 tests
+
+    // Growable pool, starts with one 2^12 block and can grow to four
+    fprintf(stdout, "\nRunning tests for pool5!\n");
+    Balloc pool5 = bcreatex(4096, 4, 12, 16384, BALLOC_GROWABLE);
+
+    // Test 16: Allocations past the starting size grow the pool
+    fprintf(stdout, "\nAllocations of size 4096, 4 times!\n");
+    void *allocation1 = balloc(pool5, 4096);
+    void *allocation2 = balloc(pool5, 4096);
+    void *allocation3 = balloc(pool5, 4096);
+    void *allocation4 = balloc(pool5, 4096);
+    fprintf(stdout, "Allocations: %p %p %p %p (none should be nil)\n", allocation1, allocation2, allocation3, allocation4);
+
+    // Test 17: The grown memory can be written to
+    memset(allocation4, 0xff, 4096);
+
+    // Test 18: Nothing is left to grow into
+    void *allocation5 = balloc(pool5, 16);
+    fprintf(stdout, "Allocation past the limit returned: %p (should be nil)\n", allocation5);
+
+    // Tests complete
+    bfree(pool5, allocation1);
+    bfree(pool5, allocation2);
+    bfree(pool5, allocation3);
+    bfree(pool5, allocation4);
+    bprint(pool5);
+    bdelete(pool5);
+
+    fprintf(stdout, "\nPool5 tests complete!\n");
+
+    return;
+}
+
+void testpool6()
+{
+    // pool6 tests
+
+    // Pool that is not a power of 2, two 2^5 blocks and a 2^4 tail
+    fprintf(stdout, "\nRunning tests for pool6!\n");
+    Balloc pool6 = bcreate(80, 4, 5);
+
+    // Test 19: Whole pool can be used without rounding it up to 128
+    fprintf(stdout, "\nAllocations of size 32, 2 times and 16, 1 time!\n");
+    void *allocation1 = balloc(pool6, 32);
+    void *allocation2 = balloc(pool6, 32);
+    void *allocation3 = balloc(pool6, 16);
+    fprintf(stdout, "Allocations: %p %p %p (none should be nil)\n", allocation1, allocation2, allocation3);
+
+    // Test 20: Nothing past the 80 bytes is handed out
+    void *allocation4 = balloc(pool6, 16);
+    fprintf(stdout, "Allocation on a full pool returned: %p (should be nil)\n", allocation4);
+
+    // Tests complete
+    bfree(pool6, allocation1);
+    bfree(pool6, allocation2);
+    bfree(pool6, allocation3);
+    bprint(pool6);
+    bdelete(pool6);
+
+    fprintf(stdout, "\nPool6 tests complete!\n");
+
+    return;
+}
+
+void testpool7()
+{
+    // pool7 tests
+
+    // Growable pool that can reach 16 GiB, only the pages that get touched are ever backed
+    fprintf(stdout, "\nRunning tests for pool7!\n");
+    Balloc pool7 = bcreatex(e2size(12), 12, 33, e2size(34), BALLOC_GROWABLE);
+
+    // Test 21: Blocks past 4 GiB
+    fprintf(stdout, "\nAllocations of size 2^33 and 2^32!\n");
+    char *allocation1 = balloc(pool7, e2size(33));
+    char *allocation2 = balloc(pool7, e2size(32));
+    fprintf(stdout, "Allocations: %p %p (none should be nil)\n", allocation1, allocation2);
+
+    // Test 22: Sizes are not cut off at 32 bits
+    fprintf(stdout, "The size of the allocations are: %zu %zu\n", bsize(pool7, allocation1), bsize(pool7, allocation2));
+
+    // Test 23: The far end of the blocks can be written to
+    allocation1[e2size(33) - 1] = 1;
+    allocation2[e2size(32) - 1] = 1;
+
+    // Tests complete
+    bfree(pool7, allocation1);
+    bfree(pool7, allocation2);
+    bdelete(pool7);
+
+    fprintf(stdout, "\nPool7 tests complete!\n");
+
+    return;
+}
+
+// Shared by the testpool8() threads
+static Balloc pool8;
+
+// Thread used by testpool8(), allocates and frees blocks of its own size
+// and checks nobody else wrote into them
+void *churn(void *arg)
+{
+    // Every thread uses a different size (and fill byte)
+    long id = (long)arg;
+    size_t size = e2size(4 + id);
+
+    for (int i = 0; i < 10000; i++)
+    {
+        unsigned char *allocation = balloc(pool8, size);
+        if (allocation == NULL)
+        {
+            continue;
+        }
+
+        // Fill it, let the other threads run, then check it is untouched
+        memset(allocation, id, size);
+        for (size_t j = 0; j < size; j++)
+        {
+            if (allocation[j] != id)
+            {
+                return (void *)1;
+            }
+        }
+        bfree(pool8, allocation);
+    }
+
+    return NULL;
+}
+
+// Runs 4 churn() threads on pool8
+// Returns: int, how many of them saw their block written by another
+int runchurn()
+{
+    pthread_t threads[4];
+    for (long i = 0; i < 4; i++)
+    {
+        pthread_create(&threads[i], NULL, churn, (void *)i);
+    }
+
+    int overlaps = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        overlaps += result != NULL;
+    }
+
+    return overlaps;
+}
+
+void testpool8()
+{
+    // pool8 tests
+
+    // Pool shared by 4 threads, once for every way it can be shared
+    fprintf(stdout, "\nRunning tests for pool8!\n");
+    const int flags[3] = {BALLOC_THREADSAFE, BALLOC_CACHED, BALLOC_LOCKFREE};
+    const char *names[3] = {"locked", "cached", "lock-free"};
+
+    for (int i = 0; i < 3; i++)
+    {
+        pool8 = bcreatex(e2size(12), 4, 12, 0, flags[i]);
+
+        // Test 24: Threads allocating different sizes at once get blocks nobody else has
+        fprintf(stdout, "\nThreads sharing a %s pool\n", names[i]);
+        fprintf(stdout, "Threads that saw their block written by another: %d (should be 0)\n", runchurn());
+
+        // Test 25: Everything merged back (and any caches were flushed when the threads exited)
+        void *allocation1 = balloc(pool8, e2size(12));
+        fprintf(stdout, "Allocation of the whole pool returned: %p (should not be nil)\n", allocation1);
+
+        bfree(pool8, allocation1);
+        bdelete(pool8);
+    }
+
+    // Tests complete
+    fprintf(stdout, "\nPool8 tests complete!\n");
+
+    return;
+}
+
+// Thread used by testpool9(), frees a block from another thread's arena
+void *freeelsewhere(void *arg)
+{
+    bfree(pool8, arg);
+    return NULL;
+}
+
+void testpool9()
+{
+    // pool9 tests
+
+    // Pool made of 4 arenas of 2^12 each
+    fprintf(stdout, "\nRunning tests for pool9!\n");
+    Balloc pool9 = bcreatearenas(e2size(12), 4, 12, 0, BALLOC_THREADSAFE, 4);
+
+    // Test 26: Filling the thread's arena moves on to the next ones
+    fprintf(stdout, "\nAllocations of size 4096, 5 times!\n");
+    void *allocations[5];
+    for (int i = 0; i < 5; i++)
+    {
+        allocations[i] = balloc(pool9, e2size(12));
+    }
+    fprintf(stdout, "Allocations: %p %p %p %p (none should be nil)\n", allocations[0], allocations[1], allocations[2], allocations[3]);
+    fprintf(stdout, "Allocation with every arena full returned: %p (should be nil)\n", allocations[4]);
+
+    // Test 27: Sizes and frees find the arena a block came from
+    fprintf(stdout, "The size of the last allocation is: %zu\n", bsize(pool9, allocations[3]));
+    fprintf(stdout, "Pool owns the last allocation: %d (should be 1)\n", bowns(pool9, allocations[3]));
+    fprintf(stdout, "Pool owns a stack address: %d (should be 0)\n", bowns(pool9, allocations));
+    for (int i = 0; i < 4; i++)
+    {
+        bfree(pool9, allocations[i]);
+    }
+    bdelete(pool9);
+
+    // Test 28: Threads spread over the arenas
+    pool8 = bcreatearenas(e2size(12), 4, 12, 0, BALLOC_THREADSAFE, 4);
+    fprintf(stdout, "Threads that saw their block written by another: %d (should be 0)\n", runchurn());
+
+    // Test 29: A block freed by a thread on another arena is queued, and freed
+    // for real once its own arena runs out of memory
+    void *allocation1 = balloc(pool8, e2size(12));
+    pthread_t thread;
+    pthread_create(&thread, NULL, freeelsewhere, allocation1);
+    pthread_join(thread, NULL);
+
+    void *allocation2 = balloc(pool8, e2size(12));
+    fprintf(stdout, "Allocation after a remote free returned: %p (should be %p)\n", allocation2, allocation1);
+
+    bfree(pool8, allocation2);
+    bdelete(pool8);
+
+    fprintf(stdout, "\nPool9 tests complete!\n");
+
+    return;
+}
+
+void testpool10()
+{
+    // pool10 tests
+
+    // Pool to resize blocks in
+    fprintf(stdout, "\nRunning tests for pool10!\n");
+    Balloc pool10 = bcreate(e2size(10), 4, 10);
+
+    // Test 30: Growing into the wilderness right after the block does not move it
+    void *allocation1 = balloc(pool10, 64);
+    strcpy(allocation1, "kept");
+    void *allocation2 = brealloc(pool10, allocation1, 128);
+    fprintf(stdout, "Growing 64 to 128 returned: %p (should be %p)\n", allocation2, allocation1);
+
+    // Test 31: Growing into a free buddy does not move it either
+    void *allocation3 = balloc(pool10, 128);
+    void *allocation4 = balloc(pool10, 256);
+    bfree(pool10, allocation3);
+    allocation2 = brealloc(pool10, allocation1, 256);
+    fprintf(stdout, "Growing 128 to 256 returned: %p (should be %p)\n", allocation2, allocation1);
+    fprintf(stdout, "The size of the grown block is: %zu, and it holds: %s (should be 256, kept)\n", bsize(pool10, allocation2), (char *)allocation2);
+
+    // Test 32: Shrinking gives the tail back
+    allocation2 = brealloc(pool10, allocation1, 16);
+    allocation3 = balloc(pool10, 16);
+    fprintf(stdout, "Shrinking 256 to 16 returned: %p (should be %p), the size is: %zu (should be 16)\n", allocation2, allocation1, bsize(pool10, allocation2));
+    fprintf(stdout, "Allocation of 16 after the shrink returned: %p (should be %p)\n", allocation3, (char *)allocation1 + 16);
+
+    // Tests complete
+    bfree(pool10, allocation2);
+    bfree(pool10, allocation3);
+    bfree(pool10, allocation4);
+    bdelete(pool10);
+
+    fprintf(stdout, "\nPool10 tests complete!\n");
+
+    return;
+}
+
+void testpool11()
+{
+    // pool11 tests
+
+    // Pool to allocate batches from
+    fprintf(stdout, "\nRunning tests for pool11!\n");
+    Balloc pool11 = bcreate(e2size(10), 4, 10);
+
+    // Test 33: A batch comes out of one split block, next to each other
+    fprintf(stdout, "\nAllocations of size 16, 20 times at once!\n");
+    void *allocations[64];
+    size_t count = ballocn(pool11, 16, 20, allocations);
+    int adjacent = 1;
+    for (size_t i = 1; i < count; i++)
+    {
+        adjacent &= (char *)allocations[i] == (char *)allocations[i - 1] + 16;
+    }
+    fprintf(stdout, "Allocated: %zu (should be 20), all next to each other: %d (should be 1)\n", count, adjacent);
+
+    // Test 34: What was left of the split block is free, and a batch stops when the pool runs out
+    size_t more = ballocn(pool11, 16, 64, allocations + count);
+    fprintf(stdout, "Allocated after that: %zu (should be 44)\n", more);
+
+    // Test 35: Freeing the whole batch at once (out of order) merges everything back
+    void *allocation1 = allocations[0];
+    allocations[0] = allocations[count + more - 1];
+    allocations[count + more - 1] = allocation1;
+    bfreen(pool11, allocations, count + more);
+    allocation1 = balloc(pool11, e2size(10));
+    fprintf(stdout, "Allocation of the whole pool returned: %p (should not be nil)\n", allocation1);
+
+    // Tests complete
+    bfree(pool11, allocation1);
+    bdelete(pool11);
+
+    fprintf(stdout, "\nPool11 tests complete!\n");
+
+    return;
+}
+
+void testpool12()
+{
+    // pool12 tests
+
+    // Pool that merges lazily
+    fprintf(stdout, "\nRunning tests for pool12!\n");
+    Balloc pool12 = bcreatex(e2size(10), 4, 10, 0, BALLOC_LAZY);
+
+    // Test 36: Freed buddies are kept as they are, and handed out again without splitting
+    void *allocation1 = balloc(pool12, 16);
+    void *allocation2 = balloc(pool12, 16);
+    bfree(pool12, allocation1);
+    bfree(pool12, allocation2);
+
+    // Output should show both 16s on the lazy list
+    bprint(pool12);
+
+    void *allocation3 = balloc(pool12, 16);
+    fprintf(stdout, "Allocation of 16 after freeing both returned: %p (should be %p)\n", allocation3, allocation2);
+    bfree(pool12, allocation3);
+
+    // Test 37: Running short merges everything that was kept
+    allocation1 = balloc(pool12, e2size(10));
+    fprintf(stdout, "Allocation of the whole pool returned: %p (should not be nil)\n", allocation1);
+
+    // Tests complete
+    bfree(pool12, allocation1);
+    bdelete(pool12);
+
+    fprintf(stdout, "\nPool12 tests complete!\n");
+
+    return;
+}
+
+void testpool13()
+{
+    // pool13 tests
+
+    // Pool that refills its smallest order 8 blocks at a time
+    fprintf(stdout, "\nRunning tests for pool13!\n");
+    Balloc pool13 = bcreate(e2size(10), 4, 10);
+    bsetrefill(pool13, 4, 8);
+
+    // Test 38: One 128 block is cut into 16s, the ones after the first wait on the list
+    void *allocation1 = balloc(pool13, 16);
+    void *allocation2 = balloc(pool13, 16);
+    fprintf(stdout, "Allocations: %p %p (should be next to each other)\n", allocation1, allocation2);
+
+    // Output should show 6 16s on the lazy list
+    bprint(pool13);
+
+    // Test 39: Running short merges them back
+    bfree(pool13, allocation1);
+    bfree(pool13, allocation2);
+    allocation1 = balloc(pool13, e2size(10));
+    fprintf(stdout, "Allocation of the whole pool returned: %p (should not be nil)\n", allocation1);
+
+    // Tests complete
+    bfree(pool13, allocation1);
+    bdelete(pool13);
+
+    fprintf(stdout, "\nPool13 tests complete!\n");
+
+    return;
+}
+
+void testpool14()
+{
+    // pool14 tests
+
+    // Pool that hands out the lowest free block first
+    fprintf(stdout, "\nRunning tests for pool14!\n");
+    Balloc pool14 = bcreatex(e2size(10), 4, 10, 0, BALLOC_ORDERED);
+
+    void *allocations[8];
+    for (int i = 0; i < 8; i++)
+    {
+        allocations[i] = balloc(pool14, 16);
+    }
+
+    // Test 40: Blocks freed out of order come back lowest address first
+    bfree(pool14, allocations[6]);
+    bfree(pool14, allocations[1]);
+    bfree(pool14, allocations[4]);
+
+    // Output should show the three 16s in address order
+    bprint(pool14);
+
+    void *allocation1 = balloc(pool14, 16);
+    void *allocation2 = balloc(pool14, 16);
+    void *allocation3 = balloc(pool14, 16);
+    fprintf(stdout, "Allocations: %p %p %p (should be %p %p %p)\n", allocation1, allocation2, allocation3, allocations[1], allocations[4], allocations[6]);
+
+    // Test 41: With everything freed, a small block comes from the start of the pool again
+    for (int i = 0; i < 8; i++)
+    {
+        bfree(pool14, allocations[i]);
+    }
+    allocation1 = balloc(pool14, 64);
+    fprintf(stdout, "Allocation returned: %p (should be %p)\n", allocation1, allocations[0]);
+
+    // Tests complete
+    bfree(pool14, allocation1);
+    bdelete(pool14);
+
+    fprintf(stdout, "\nPool14 tests complete!\n");
+
+    return;
+}
+
+void testpool15()
+{
+    // pool15 tests
+
+    fprintf(stdout, "\nRunning tests for pool15!\n");
+
+    // Test 42: A pool that can not grow still starts on a 2^u boundary
+    Balloc pool15 = bcreate(e2size(16), 4, 16);
+    void *allocation1 = balloc(pool15, e2size(16));
+    fprintf(stdout, "Offset of the 2^16 block from a 2^16 boundary: %zu (should be 0)\n", (size_t)allocation1 & (e2size(16) - 1));
+    bfree(pool15, allocation1);
+    bdelete(pool15);
+
+    // Test 43: So does a growable pool whose size is its limit
+    pool15 = bcreatex(e2size(16), 4, 16, e2size(16), BALLOC_GROWABLE);
+    allocation1 = balloc(pool15, e2size(16));
+    fprintf(stdout, "Offset of the 2^16 block from a 2^16 boundary: %zu (should be 0)\n", (size_t)allocation1 & (e2size(16) - 1));
+    bfree(pool15, allocation1);
+
+    // Test 44: Alignments past 2^u are mapped on their own at the alignment
+    allocation1 = ballocalign(pool15, 10, e2size(22));
+    fprintf(stdout, "Offset of the aligned block from a 2^22 boundary: %zu (should be 0)\n", (size_t)allocation1 & (e2size(22) - 1));
+
+    // Tests complete
+    bfree(pool15, allocation1);
+    bdelete(pool15);
+
+    // Test 45: A pool bigger than the address space is refused, not fatal
+    pool15 = bcreatex(e2size(12), 4, 12, e2size(50), BALLOC_GROWABLE);
+    fprintf(stdout, "Pool past the address space returned: %p (should be nil)\n", pool15);
+
+    fprintf(stdout, "\nPool15 tests complete!\n");
+
+    return;
+}
+
+void testpool16()
+{
+    // pool16 tests
+
+    // Growable pool that caches blocks per thread
+    fprintf(stdout, "\nRunning tests for pool16!\n");
+    Balloc pool16 = bcreatex(e2size(12), 4, 12, e2size(16), BALLOC_GROWABLE | BALLOC_CACHED);
+
+    // Filling the whole pool with 16s
+    void *allocations[256];
+    char *lowest = NULL;
+    char *highest = NULL;
+    for (int i = 0; i < 256; i++)
+    {
+        allocations[i] = balloc(pool16, 16);
+    }
+
+    // Every other one is freed, none of them can merge
+    for (int i = 1; i < 256; i += 2)
+    {
+        bfree(pool16, allocations[i]);
+    }
+
+    // Test 46: Blocks freed through the cache are used again, the pool does not grow
+    for (int i = 1; i < 256; i += 2)
+    {
+        allocations[i] = balloc(pool16, 16);
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        if (lowest == NULL || (char *)allocations[i] < lowest)
+        {
+            lowest = allocations[i];
+        }
+        if ((char *)allocations[i] > highest)
+        {
+            highest = allocations[i];
+        }
+    }
+    fprintf(stdout, "Blocks were spread over %td bytes (should be %zu)\n", highest - lowest + 16, e2size(12));
+
+    // Tests complete
+    for (int i = 0; i < 256; i++)
+    {
+        bfree(pool16, allocations[i]);
+    }
+    bdelete(pool16);
+
+    fprintf(stdout, "\nPool16 tests complete!\n");
+
+    return;
+}
+
 int main()
 {
 
@@ -165,6 +753,19 @@ int main()
     testpool1();
     testpool2();
     testpool3();
+    testpool4();
+    testpool5();
+    testpool6();
+    testpool7();
+    testpool8();
+    testpool9();
+    testpool10();
+    testpool11();
+    testpool12();
+    testpool13();
+    testpool14();
+    testpool15();
+    testpool16();
 
     // RUNNING DEQ TEST PORTION
     fprintf(stdout, "Running a simple deq test\n");
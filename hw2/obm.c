@@ -0,0 +1,166 @@
+/**
+ * An ordered bitmap: a bit per block of one size, with a summary tree on top
+ * of it so the lowest set bit (the lowest free block) is found in O(log n).
+ *
+ * Every row has a bit per word of the row below it, set while that word is
+ * not zero, and the last row is a single word. With 64 bits to a word a
+ * pool of 2^40 blocks is only 7 rows deep.
+ *
+ * @version 1.0
+ *
+ */
+
+#include <stdint.h>
+
+#include "obm.h"
+#include "utils.h"
+
+// Enough rows for any number of blocks a size_t can count
+#define ROWS 11
+
+// The bits of every row, the blocks themselves are row 0
+struct Tree
+{
+  int depth;
+  size_t words[ROWS];
+  uint64_t *rows[ROWS];
+} typedef Tree;
+
+// Gets how many words a row has
+// bits = How many bits the row has
+// Returns: size_t, the number of words
+static size_t rowwords(size_t bits)
+{
+  return divup(bits, 64);
+}
+
+// Gets the number of blocks the bitmap covers
+// size = Size of the whole pool
+// e = Size of the block exponent
+// Returns: size_t, how many blocks there are in the map
+static size_t mapsize(size_t size, int e)
+{
+  return divup(size, e2size(e));
+}
+
+// Gets the index of a block
+// * base = The base address of the memory pool
+// * mem = The address of the block
+// e = Size of the block exponent
+// Returns: size_t, the bit of the block
+static size_t bitaddr(void *base, void *mem, int e)
+{
+  return (size_t)((char *)mem - (char *)base) >> e;
+}
+
+// Gets how many bytes an ordered bitmap takes up, including its header
+// size = The size of the pool
+// e = Size of the block exponent
+// Returns: size_t, the number of bytes obmplace() needs
+extern size_t obmspace(size_t size, int e)
+{
+  size_t words = 0;
+  size_t bits = mapsize(size, e);
+  do
+  {
+    bits = rowwords(bits);
+    words += bits;
+  } while (bits > 1);
+  return sizeof(Tree) + words * sizeof(uint64_t);
+}
+
+// Creates an ordered bitmap inside memory the caller already owns
+// * p = obmspace(size, e) bytes of zeroed memory
+// size = The size of the pool
+// e = Size of the block exponent
+// Returns: OBM, an ordered bitmap that goes away with p
+extern OBM obmplace(void *p, size_t size, int e)
+{
+  Tree *t = p;
+  uint64_t *words = (uint64_t *)(t + 1);
+  size_t bits = mapsize(size, e);
+
+  // The rows follow the header, from the blocks up to the single top word
+  t->depth = 0;
+  do
+  {
+    bits = rowwords(bits);
+    t->rows[t->depth] = words;
+    t->words[t->depth++] = bits;
+    words += bits;
+  } while (bits > 1);
+  return t;
+}
+
+// Sets the bit of a block, and the summary bits above it that were clear
+// b = An ordered bitmap
+// * base = The base address of the memory pool
+// * mem = The address of the block
+// e = Size of the block exponent
+extern void obmset(OBM b, void *base, void *mem, int e)
+{
+  Tree *t = b;
+  size_t i = bitaddr(base, mem, e);
+  for (int r = 0; r < t->depth; r++, i >>= 6)
+  {
+    uint64_t old = t->rows[r][i >> 6];
+    t->rows[r][i >> 6] = old | (uint64_t)1 << (i & 63);
+    if (old)
+      return;
+  }
+}
+
+// Clears the bit of a block, and the summary bits above it that cover nothing anymore
+// b = An ordered bitmap
+// * base = The base address of the memory pool
+// * mem = The address of the block
+// e = Size of the block exponent
+extern void obmclr(OBM b, void *base, void *mem, int e)
+{
+  Tree *t = b;
+  size_t i = bitaddr(base, mem, e);
+  for (int r = 0; r < t->depth; r++, i >>= 6)
+  {
+    if ((t->rows[r][i >> 6] &= ~((uint64_t)1 << (i & 63))))
+      return;
+  }
+}
+
+// Tests whether any bit is set
+// b = An ordered bitmap
+// Returns: int, 1 if some block is set, 0 if none
+extern int obmany(OBM b)
+{
+  Tree *t = b;
+  return t->rows[t->depth - 1][0] != 0;
+}
+
+// Finds the lowest set block at or after an address
+// Climbs until a word has a set bit past the spot, then follows the lowest
+// set bits back down
+// b = An ordered bitmap
+// * base = The base address of the memory pool
+// * from = Where to start looking (base for the lowest block of all)
+// e = Size of the block exponent
+// Returns: void *, the block, or NULL if none is set at or after from
+extern void *obmfirst(OBM b, void *base, void *from, int e)
+{
+  Tree *t = b;
+  size_t i = bitaddr(base, from, e);
+  for (int r = 0; r < t->depth; r++)
+  {
+    size_t w = i >> 6;
+    if (w >= t->words[r])
+      return NULL;
+    uint64_t word = t->rows[r][w] & ~(uint64_t)0 << (i & 63);
+    if (word)
+    {
+      i = (w << 6) | __builtin_ctzll(word);
+      while (r-- > 0)
+        i = (i << 6) | __builtin_ctzll(t->rows[r][i]);
+      return (char *)base + (i << e);
+    }
+    i = w + 1;
+  }
+  return NULL;
+}
@@ -0,0 +1,18 @@
+// An ordered bitmap of free blocks, for address-ordered free lists.
+
+#ifndef OBM_H
+#define OBM_H
+
+#include <stdio.h>
+
+typedef void *OBM;
+
+extern size_t obmspace(size_t size, int e);
+extern OBM  obmplace(void *p, size_t size, int e);
+
+extern void obmset(OBM b, void *base, void *mem, int e);
+extern void obmclr(OBM b, void *base, void *mem, int e);
+extern  int obmany(OBM b);
+extern void *obmfirst(OBM b, void *base, void *from, int e);
+
+#endif
@@ -10,9 +10,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 // Used for bitshifting to get values
-static const int bitShiftingExponentiation = 1;
+static const size_t bitShiftingExponentiation = 1;
 
 // Number of bits in a byte
 static const int bitsInAByte = 8;
@@ -20,7 +21,7 @@ static const int bitsInAByte = 8;
 // Calls mmap which with a provided size, will map the address space
 // of the given range, effectively
 // size = size of how much bytes should be mapped
-// Returns: void *, the initial address where the memory is mapped into the address space
+// Returns: void *, the initial address where the memory is mapped into the address space, or NULL if it could not be mapped
 void *mmalloc(size_t size)
 {
 
@@ -28,12 +29,10 @@ void *mmalloc(size_t size)
     void *poolAddr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
     // Checking to see if the mapping was a success, MAP_FAILED is a constant from mmam.h for a fail pointer
+    // (running out of memory is up to the caller, pools report it by returning NULL)
     if (poolAddr == MAP_FAILED)
     {
-
-        // Output error message
-        fprintf(stderr, "Memory mapping failed!\n");
-        exit(1);
+        return NULL;
     }
 
     return poolAddr;
@@ -60,6 +59,35 @@ void mmfree(void *p, size_t size)
     }
 }
 
+// Reserves a range of the address space without backing it with memory,
+// nothing in it can be touched until it is committed with mmcommit()
+// size = size of how much address space should be reserved
+// Returns: void *, the initial address of the reserved range, or NULL if the address space ran out
+void *mmreserve(size_t size)
+{
+
+    // Mapping with no access and no swap reserved, so only the address space is used
+    void *rangeAddr = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    // Checking to see if the mapping was a success
+    if (rangeAddr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return rangeAddr;
+}
+
+// Commits part of a reserved range so it can be read and written
+// (pages are still only backed by memory once they are touched)
+// * p = The start of the part to commit (page aligned)
+// size = How many bytes to commit
+// Returns: int, 1 if it was committed, 0 if the system refused
+int mmcommit(void *p, size_t size)
+{
+    return mprotect(p, size, PROT_READ | PROT_WRITE) == 0;
+}
+
 // Calculates the size of a provided exponent
 // e = The exponent of a 2-base (Ex: 2 ^ (4) <--e)
 // Returns: size_t, the size of the exponent
@@ -113,6 +141,32 @@ size_t divup(size_t n, size_t d)
     return (n + d - 1) / d;
 }
 
+// Rounds a number up to the next multiple of another
+// n = The number to round
+// m = The multiple
+// Returns: size_t, the smallest multiple of m that is at least n
+size_t roundup(size_t n, size_t m)
+{
+    return divup(n, m) * m;
+}
+
+// Orders two addresses in an array of pointers, for qsort()
+// * a = The first pointer
+// * b = The second pointer
+// Returns: int, negative, 0 or positive like any qsort() comparison
+int compareaddresses(const void *a, const void *b)
+{
+    char *first = *(char *const *)a, *second = *(char *const *)b;
+    return (first > second) - (first < second);
+}
+
+// Gets the size of a page of memory
+// Returns: size_t, the page size mmap() works in
+size_t pagesize()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
 // Converts the provided number of bits into the respective amount of bytes
 // bits = The number of bits
 // Returns: size_t, of the amount bytes from the bits given
@@ -5,10 +5,18 @@
 
 static const int bitsperbyte=8;
 
+// Metadata that is read together is kept on its own cache lines
+static const size_t cachelinesize=64;
+
 extern void *mmalloc(size_t size);
 extern void mmfree(void *p, size_t size);
+extern void *mmreserve(size_t size);
+extern int mmcommit(void *p, size_t size);
 
 extern size_t divup(size_t n, size_t d);
+extern size_t roundup(size_t n, size_t m);
+extern int compareaddresses(const void *a, const void *b);
+extern size_t pagesize();
 extern size_t bits2bytes(size_t bits);
 
 extern size_t e2size(int e);
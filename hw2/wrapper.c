@@ -1,29 +1,209 @@
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "balloc.h"
+#include "utils.h"
 
-static Balloc bp = 0;
+// Drop-in malloc() family on top of growable, cached balloc pools.
+// Built into libballoc.so (make libballoc.so) so it can be LD_PRELOADed.
+// Requests are routed by size to one pool per size class, so short lived
+// small objects do not break up the blocks large ones need:
+//   tiny   2^4  .. 2^8  bytes
+//   medium 2^9  .. 2^16 bytes (blocks of 2^8 and up)
+//   large  2^17 .. 2^24 bytes (blocks of 2^16 and up)
+// and anything bigger is mapped on its own by the large pool.
+// Every pool is sized from the environment the first time it is needed:
+//   BALLOC_SIZE   = bytes committed up front        (default 1 MiB)
+//   BALLOC_LIMIT  = bytes the pool may grow to      (default 1 GiB)
+//   BALLOC_ARENAS = independent arenas, 1 for none  (default 1)
 
-#include <stdio.h>
+struct Class {
+  int l, u;
+  Balloc pool;
+} typedef Class;
+
+static Class classes[] = {{4, 8}, {8, 16}, {16, 24}};
+
+#define CLASSES ((int)(sizeof(classes) / sizeof(classes[0])))
+
+static int bpOk = 0;
+static pthread_once_t bpOnce = PTHREAD_ONCE_INIT;
+
+// Reads a number from the environment, or def if it is not set
+static size_t envsize(const char *name, size_t def)
+{
+  char *value = getenv(name);
+  if (!value || !*value)
+    return def;
+  return strtoull(value, 0, 0);
+}
+
+// Every pool's locks are held across fork(), so the child never starts with one another thread held
+static Balloc bpPools[CLASSES];
+
+static void bpprepare()
+{
+  blockall(bpPools, CLASSES);
+}
+
+static void bpresume()
+{
+  bunlockall(bpPools, CLASSES);
+}
+
+static void bpcreate()
+{
+  size_t size = envsize("BALLOC_SIZE", (size_t)1 << 20);
+  size_t limit = envsize("BALLOC_LIMIT", (size_t)1 << 30);
+  int n = envsize("BALLOC_ARENAS", 1);
+  int flags = BALLOC_GROWABLE | BALLOC_CACHED;
+  for (int i = 0; i < CLASSES; i++) {
+    Class *c = &classes[i];
+    c->pool = n > 1 ? bcreatearenas(size, c->l, c->u, limit, flags, n)
+                    : bcreatex(size, c->l, c->u, limit, flags);
+    if (!c->pool)
+      return;
+    bpPools[i] = c->pool;
+  }
+  pthread_atfork(bpprepare, bpresume, bpresume);
+  bpOk = 1;
+}
+
+// The pool for a request of size bytes (0 if the pools could not be made)
+static Balloc sizepool(size_t size)
+{
+  pthread_once(&bpOnce, bpcreate);
+  if (!bpOk)
+    return 0;
+  int e = size2e(size);
+  for (int i = 0; i < CLASSES; i++)
+    if (e <= classes[i].u)
+      return classes[i].pool;
+  return classes[CLASSES - 1].pool;
+}
+
+// The pool a block belongs to (the last one if none, which reports the bad block)
+static Balloc blockpool(void *ptr)
+{
+  pthread_once(&bpOnce, bpcreate);
+  int i = 0;
+  while (i < CLASSES - 1 && !bowns(classes[i].pool, ptr))
+    i++;
+  return classes[i].pool;
+}
 
 extern void *malloc(size_t size)
 {
-  bp = bp ? bp : bcreate(4096, 4, 12);
-  return balloc(bp, size);
+  size = size ? size : 1;
+  Balloc pool = sizepool(size);
+  void *mem = pool ? balloc(pool, size) : 0;
+  if (!mem)
+    errno = ENOMEM;
+  return mem;
 }
 
 extern void free(void *ptr)
 {
-  bfree(bp, ptr);
+  if (!ptr)
+    return;
+  bfree(blockpool(ptr), ptr);
+}
+
+extern void *calloc(size_t nmemb, size_t size)
+{
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    errno = ENOMEM;
+    return 0;
+  }
+  void *mem = malloc(total);
+  if (mem)
+    memset(mem, 0, total);
+  return mem;
 }
 
 extern void *realloc(void *ptr, size_t size)
 {
-  size_t min(size_t x, size_t y) { return x < y ? x : y; }
-  void *new = malloc(size);
   if (!ptr)
+    return malloc(size);
+  if (!size) {
+    free(ptr);
+    return 0;
+  }
+  // Staying in its size class, the pool resizes it
+  Balloc pool = blockpool(ptr);
+  if (pool == sizepool(size)) {
+    void *new = brealloc(pool, ptr, size);
+    if (!new)
+      errno = ENOMEM;
     return new;
-  memcpy(new, ptr, min(size, bsize(bp, ptr)));
+  }
+  // Otherwise it moves to the pool of its new class (or stays if that is full and it shrank)
+  size_t old = bsize(pool, ptr);
+  void *new = malloc(size);
+  if (!new)
+    return old >= size ? ptr : 0;
+  memcpy(new, ptr, old < size ? old : size);
   free(ptr);
   return new;
 }
+
+extern void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+  size_t total;
+  if (__builtin_mul_overflow(nmemb, size, &total)) {
+    errno = ENOMEM;
+    return 0;
+  }
+  return realloc(ptr, total);
+}
+
+// Blocks are aligned to their own size, so the pool for a block of at least
+// alignment bytes is used, and the pool maps bigger alignments on their own
+extern void *memalign(size_t alignment, size_t size)
+{
+  if (alignment & (alignment - 1)) {
+    errno = EINVAL;
+    return 0;
+  }
+  size = size ? size : 1;
+  alignment = alignment ? alignment : 1;
+  Balloc pool = sizepool(size > alignment ? size : alignment);
+  void *mem = pool ? ballocalign(pool, size, alignment) : 0;
+  if (!mem)
+    errno = ENOMEM;
+  return mem;
+}
+
+extern int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+    return EINVAL;
+  void *mem = memalign(alignment, size);
+  if (!mem)
+    return ENOMEM;
+  *memptr = mem;
+  return 0;
+}
+
+extern void *aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
+
+extern void *valloc(size_t size)
+{
+  return memalign(4096, size);
+}
+
+extern void *pvalloc(size_t size)
+{
+  return memalign(4096, (size + 4095) & ~(size_t)4095);
+}
+
+extern size_t malloc_usable_size(void *ptr)
+{
+  return ptr ? bsize(blockpool(ptr), ptr) : 0;
+}